@@ -1,10 +1,13 @@
 #include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <unistd.h>
 #include <signal.h>
 #include <pthread.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/resource.h>
 #include <libtorque/alloc.h>
 #include <libtorque/hardware/memory.h>
@@ -13,6 +16,10 @@
 #define MAP_ANONYMOUS MAP_ANON
 #endif
 
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
 void *get_pages(size_t s){
 	const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
 	void *ret;
@@ -30,6 +37,228 @@ void *get_big_page(const struct torque_ctx *ctx,size_t *s){
 	return get_pages(*s);
 }
 
+// The ring's memory must be a shareable object, so that it can be mapped
+// twice: a memfd where available, and otherwise an unlinked file in tmpfs.
+static int
+ring_fd(size_t s){
+	int fd = -1;
+
+#if defined(TORQUE_LINUX) && defined(SYS_memfd_create)
+	fd = syscall(SYS_memfd_create,"torque-ring",MFD_CLOEXEC);
+#endif
+#ifdef TORQUE_FREEBSD
+	fd = shm_open(SHM_ANON,O_RDWR,0600);
+#else
+	if(fd < 0){
+		char path[] = "/dev/shm/torque-ringXXXXXX";
+
+		if((fd = mkstemp(path)) >= 0){
+			unlink(path);
+		}
+	}
+#endif
+	if(fd >= 0 && ftruncate(fd,s)){
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+// Reserve the whole span, and then map the object twice over it.
+void *get_ring_pages(size_t s){
+	const int flags = MAP_SHARED | MAP_FIXED;
+	char *ret;
+	int fd;
+
+	if((fd = ring_fd(s)) < 0){
+		return NULL;
+	}
+	if((ret = mmap(NULL,s * 2,PROT_NONE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0)) == MAP_FAILED){
+		close(fd);
+		return NULL;
+	}
+	if(mmap(ret,s,PROT_READ|PROT_WRITE,flags,fd,0) == MAP_FAILED ||
+		mmap(ret + s,s,PROT_READ|PROT_WRITE,flags,fd,0) == MAP_FAILED){
+		munmap(ret,s * 2);
+		close(fd);
+		return NULL;
+	}
+	close(fd); // the mappings hold the object
+	return ret;
+}
+
+void dealloc_ring(void *ring,size_t s){
+	munmap(ring,s * 2);
+}
+
+#define RING_CLASSES	16		// the page size through 2^15 pages
+#define RING_CACHED	8		// per thread, per class
+#define RING_DEPOT	64		// globally, per class
+#define RING_HOT_MAX	(1u << 16)	// larger rings are cached cold
+
+// Rings are kept in arrays rather than lists threaded through the rings
+// themselves, which might be cold (see ring_drop()).
+typedef struct ringcache {
+	void *rings[RING_CLASSES][RING_CACHED];
+	unsigned count[RING_CLASSES];
+} ringcache;
+
+static struct {
+	pthread_mutex_t lock;
+	void *rings[RING_CLASSES][RING_DEPOT];
+	unsigned count[RING_CLASSES];
+} ring_depot = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread ringcache *tsd_rings;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+// Returns the class of a ring of at least s bytes, and its length in *s, or
+// -1 if it's beyond our classes.
+static int
+ring_class(size_t *s){
+	size_t sz = sysconf(_SC_PAGESIZE);
+	int cls;
+
+	for(cls = 0 ; sz < *s ; ++cls){
+		sz <<= 1;
+	}
+	*s = sz;
+	return cls < RING_CLASSES ? cls : -1;
+}
+
+// Release the ring's pages, keeping its mappings. The ring's memory is a
+// shared object, to which MADV_FREE doesn't apply; MADV_REMOVE punches out
+// the object's pages (from both views at once).
+static inline void
+ring_drop(void *ring,size_t s){
+#ifdef MADV_REMOVE
+	madvise(ring,s,MADV_REMOVE);
+#elif defined(MADV_FREE)
+	madvise(ring,s,MADV_FREE);
+#else
+	(void)ring;
+	(void)s;
+#endif
+}
+
+static int
+depot_put(void *ring,int cls,size_t s){
+	int ret = -1;
+
+	ring_drop(ring,s);
+	pthread_mutex_lock(&ring_depot.lock);
+	if(ring_depot.count[cls] < RING_DEPOT){
+		ring_depot.rings[cls][ring_depot.count[cls]++] = ring;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&ring_depot.lock);
+	return ret;
+}
+
+// A thread's cached rings go to the depot as it exits.
+static void
+flush_rings(void *v){
+	ringcache *rc = v;
+	int cls;
+
+	for(cls = 0 ; cls < RING_CLASSES ; ++cls){
+		size_t s = (size_t)sysconf(_SC_PAGESIZE) << cls;
+
+		while(rc->count[cls]){
+			void *ring = rc->rings[cls][--rc->count[cls]];
+
+			if(depot_put(ring,cls,s)){
+				dealloc_ring(ring,s);
+			}
+		}
+	}
+	free(rc);
+}
+
+static void
+make_ring_key(void){
+	if(pthread_key_create(&ring_key,flush_rings)){
+		ring_key = (pthread_key_t)-1;
+	}
+}
+
+// NULL if the thread's cache can't be created, whereupon we go without.
+static ringcache *
+thread_rings(void){
+	if(tsd_rings == NULL){
+		ringcache *rc;
+
+		if(pthread_once(&ring_once,make_ring_key) ||
+				ring_key == (pthread_key_t)-1){
+			return NULL;
+		}
+		if((rc = malloc(sizeof(*rc))) == NULL){
+			return NULL;
+		}
+		memset(rc,0,sizeof(*rc));
+		if(pthread_setspecific(ring_key,rc)){
+			free(rc);
+			return NULL;
+		}
+		tsd_rings = rc;
+	}
+	return tsd_rings;
+}
+
+void *get_ring(size_t *s){
+	ringcache *rc;
+	void *ret;
+	int cls;
+
+	if((cls = ring_class(s)) < 0){
+		return get_ring_pages(*s);
+	}
+	if((rc = thread_rings()) && rc->count[cls]){
+		return rc->rings[cls][--rc->count[cls]];
+	}
+	ret = NULL;
+	pthread_mutex_lock(&ring_depot.lock);
+	if(ring_depot.count[cls]){
+		ret = ring_depot.rings[cls][--ring_depot.count[cls]];
+	}
+	pthread_mutex_unlock(&ring_depot.lock);
+	if(ret == NULL){
+		ret = get_ring_pages(*s);
+	}
+	return ret;
+}
+
+void put_ring(void *ring,size_t s){
+	size_t sz = s;
+	ringcache *rc;
+	int cls;
+
+	if((cls = ring_class(&sz)) < 0 || sz != s){
+		dealloc_ring(ring,s);
+		return;
+	}
+	if((rc = thread_rings()) && rc->count[cls] < RING_CACHED){
+		if(s > RING_HOT_MAX){
+			ring_drop(ring,s);
+		}
+		rc->rings[cls][rc->count[cls]++] = ring;
+		return;
+	}
+	if(depot_put(ring,cls,s)){
+		dealloc_ring(ring,s);
+	}
+}
+
+void *get_big_ring(const struct torque_ctx *ctx,size_t *s){
+	if((*s = large_system_pagesize(ctx)) == 0){
+		return NULL;
+	}
+	return get_ring(s);
+}
+
 // The default stack under NPTL is equal to RLIMIT_STACK's rlim_cur (8M on
 // my Debian machine). Coloring is used inside of NPTL as of at least
 // eglibc 2.10. PTHREAD_STACK_MIN is only 16k(!), and SIGSTKSZ 8k.
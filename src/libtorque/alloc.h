@@ -51,6 +51,38 @@ void *get_big_page(const struct torque_ctx *,size_t *)
 	__attribute__ ((nonnull(1)))
 	__attribute__ ((malloc));
 
+// A ring of the given length (a multiple of the page size), mapped twice in
+// succession: any span of up to that length, starting within the first
+// mapping, is contiguous. Free with dealloc_ring(). These are unpooled; most
+// callers want get_ring().
+void *get_ring_pages(size_t)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((malloc));
+
+void dealloc_ring(void *,size_t)
+	__attribute__ ((nonnull(1)));
+
+// Pooled rings, in power-of-two size classes from the page size up. Each
+// thread caches a few rings of each class, and a bounded global depot
+// balances rings among threads; only beyond these are rings mapped and
+// unmapped. Rings beyond the smallest classes give up their pages (but not
+// their mappings) upon being cached, as do all rings entering the depot.
+// get_ring() rounds the requested length up to its class, returning it in
+// the parameter. Free with put_ring().
+void *get_ring(size_t *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)))
+	__attribute__ ((malloc));
+
+void put_ring(void *,size_t)
+	__attribute__ ((nonnull(1)));
+
+// As get_big_page(), but a pooled ring.
+void *get_big_ring(const struct torque_ctx *,size_t *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2)))
+	__attribute__ ((malloc));
+
 void *get_stack(size_t *)
 	__attribute__ ((warn_unused_result))
 	__attribute__ ((nonnull(1)))
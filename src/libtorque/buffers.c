@@ -1,7 +1,21 @@
 #include <errno.h>
+#include <stddef.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#ifdef TORQUE_LINUX
+#include <sys/sendfile.h>
+#endif
 #include <libtorque/buffers.h>
 #include <libtorque/events/thread.h>
+#include <libtorque/hardware/memory.h>
+#ifdef TORQUE_LINUX_ZEROCOPY
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif
+
+// Bound on the scratch buffer, should the system report enormous pages.
+#define RXSCRATCH_MAX (1u << 21)
 
 static inline int
 rxback(torque_rxbuf *rxb,int fd,void *cbstate){
@@ -11,69 +25,321 @@ rxback(torque_rxbuf *rxb,int fd,void *cbstate){
 	return 0;
 }
 
+// A connection's callbacks are done with it once it's rearmed (see
+// timeouts.h).
 static inline int
-txback(torque_rxbuf *rxb,int fd,void *cbstate){
-	if(rxb->bufoff - rxb->bufate){
-		if(rxb->tx(fd,rxb,cbstate) == 0){
-			return restorefd(get_thread_evh(),fd,EVREAD);
-		}
+buffered_restorefd(torque_rxbufcb *cbctx,int fd,int flags){
+	timeouts_exit(&cbctx->to);
+	return restorefd(get_thread_evh(),fd,flags);
+}
+
+// Write interest is only registered while output remains queued.
+static inline int
+buffered_interest(const torque_rxbufcb *cbctx){
+	int flags = 0;
+
+	if(cbctx->rxbuf.rx && !cbctx->rxdone && !cbctx->txbuf.closing){
+		flags |= EVREAD;
+	}
+	if(cbctx->txbuf.head){
+		flags |= EVWRITE;
+	}
+#ifdef TORQUE_LINUX_ZEROCOPY
+	if(flags == 0 && txbuffer_zcwaiting(&cbctx->txbuf)){
+		flags = EVERROR;
+	}
+#endif
+	return flags;
+}
+
+// Write out what the callbacks queued, and rearm the fd.
+static inline int
+buffered_rearm(torque_rxbufcb *cbctx,int fd){
+	if(txbuffer_flush(&cbctx->txbuf)){
 		return -1;
 	}
-	return 0;
+	return buffered_restorefd(cbctx,fd,buffered_interest(cbctx));
 }
 
+// Should we close the fd ourselves, its callbacks are first forgotten, lest
+// the write half of an event already retrieved find the freed state.
+static void
+buffered_forget(int fd,torque_rxbufcb *cbctx){
+	setup_evsource(get_thread_ctx()->eventtables.fdarray,fd,NULL,NULL,NULL);
+	free_rxbuffercb(cbctx);
+	free(cbctx);
+	close(fd);
+}
+
+static void
+buffered_expire(int fd,torque_rxbufcb *cbctx){
+	expire_timeouts(&cbctx->to);
+	buffered_forget(fd,cbctx);
+}
+
+// On internal error, or once a closing connection's output is written.
+static void
+buffered_close(int fd,torque_rxbufcb *cbctx){
+	release_timeouts(&cbctx->to);
+	buffered_forget(fd,cbctx);
+}
+
+// A callback returned non-zero: it either closed the fd, or asked that we do
+// so once its output's been written (see torque_txclose()). Having been
+// closed by the client, the fd can't be forgotten (its number might already
+// be another's), and the write half of this same event might yet find our
+// state; it's freed at the end of the round (see reclaim_rxbuffercbs()).
+static void
+buffered_done(int fd,torque_rxbufcb *cbctx){
+	torque_txbuf *txb = &cbctx->txbuf;
+
+	if(!txb->closing){
+		evhandler *evh = get_thread_evh();
+
+		release_timeouts(&cbctx->to);
+		free_rxbuffercb(cbctx);
+		cbctx->rxbuf.buffer = NULL;
+		cbctx->closed = 1;
+		cbctx->reclaimnext = evh->reclaim;
+		evh->reclaim = cbctx;
+		return;
+	}
+	// Output sent zerocopy mustn't be released until complete, lest the
+	// client reuse memory the kernel has yet to transmit.
+	if(txbuffer_flush(txb) == 0 && (txb->head || txbuffer_zcwaiting(txb))){
+		if(buffered_restorefd(cbctx,fd,buffered_interest(cbctx)) == 0){
+			return;
+		}
+	}
+	buffered_close(fd,cbctx);
+}
+
+// A ring can't be remapped in place, so the input is copied to the start of
+// a ring of the next size class. Growth ought be rare.
 static int
 growrxbuf(torque_rxbuf *rxb){
-	typeof(*rxb->buffer) *tmp;
-	size_t news;
+	size_t news,valid;
+	const char *buf;
+	char *tmp;
 
-	news = rxb->buftot * 2; // FIXME hrmmm
-	if((tmp = mod_pages(rxb->buffer,rxb->buftot,news)) == NULL){
+	news = rxb->buftot * 2;
+	if((tmp = get_ring(&news)) == NULL){
 		return -1;
 	}
+	buf = rxbuffer_valid(rxb,&valid);
+	memcpy(tmp,buf,valid);
+	free_rxbuffer(rxb);
 	rxb->buffer = tmp;
 	rxb->buftot = news;
+	rxb->bufate = 0;
+	rxb->bufoff = valid;
 	return 0;
 }
 
+// Continue writing queued output. The write callback hears of writability
+// only once nothing remains queued. Nothing queued, but zerocopy sends
+// outstanding, means we've been called for their completions.
 void buffered_txfxn(int fd,void *cbstate){
 	torque_rxbufcb *cbctx = cbstate;
+	torque_txbuf *txb = &cbctx->txbuf;
+	int zconly;
+
+	if(cbctx->closed){ // by the read callback, handling this same event
+		return;
+	}
+	zconly = txb->head == NULL && txbuffer_zcwaiting(txb);
+	if(timeouts_enter(&cbctx->to,EVWRITE)){
+		buffered_expire(fd,cbctx);
+		return;
+	}
+	if(txbuffer_flush(txb)){
+		buffered_close(fd,cbctx);
+		return;
+	}
+	if(txb->closing){
+		if(txb->head == NULL && !txbuffer_zcwaiting(txb)){
+			buffered_close(fd,cbctx);
+			return;
+		}
+	}else if(txb->head == NULL && cbctx->rxbuf.tx && !zconly){
+		if(cbctx->rxbuf.tx(fd,&cbctx->rxbuf,cbctx)){
+			buffered_done(fd,cbctx);
+			return;
+		}
+		if(txbuffer_flush(txb)){
+			buffered_close(fd,cbctx);
+			return;
+		}
+	}
+	if(buffered_restorefd(cbctx,fd,buffered_interest(cbctx))){
+		buffered_close(fd,cbctx);
+	}
+}
+
+// The event thread's scratch buffer, allocated upon first use. It's as large
+// as a connection's buffer once was (see get_big_page()), within reason.
+static char *
+rxscratch(evhandler *evh,size_t *len){
+	if(evh->rxscratch == NULL){
+		size_t s;
+
+		if((s = large_system_pagesize(get_thread_ctx())) == 0){
+			return NULL;
+		}
+		if(s > RXSCRATCH_MAX){
+			s = RXSCRATCH_MAX;
+		}
+		if((evh->rxscratch = get_pages(s)) == NULL){
+			return NULL;
+		}
+		evh->rxscratchlen = s;
+	}
+	*len = evh->rxscratchlen;
+	return evh->rxscratch;
+}
+
+void reclaim_rxbuffercbs(evhandler *evh){
+	torque_rxbufcb *cbctx;
+
+	while( (cbctx = evh->reclaim) ){
+		evh->reclaim = cbctx->reclaimnext;
+		free(cbctx);
+	}
+}
+
+void free_rxscratch(evhandler *evh){
+	if(evh->rxscratch){
+		dealloc(evh->rxscratch,evh->rxscratchlen);
+		evh->rxscratch = NULL;
+	}
+}
+
+// Return a drained connection's storage.
+static inline void
+rxbuffer_release(torque_rxbuf *rxb){
+	if(rxb->buffer && rxb->bufoff == rxb->bufate){
+		free_rxbuffer(rxb);
+		rxb->buffer = NULL;
+		rxb->buftot = rxb->bufoff = rxb->bufate = 0;
+	}
+}
+
+// Hold the residual input in the smallest ring to fit it.
+static int
+rxbuffer_hold(torque_rxbuf *rxb,const char *res,size_t valid){
+	size_t s = valid;
+
+	if((rxb->buffer = get_ring(&s)) == NULL){
+		return -1;
+	}
+	rxb->buftot = s;
+	memcpy(rxb->buffer,res,valid);
+	rxb->bufate = 0;
+	rxb->bufoff = valid;
+	return 0;
+}
+
+// As buffered_rxview(), but on internal error, returns -1 without closing,
+// and 1 should the callback give up the fd.
+static int
+rxview(int fd,torque_rxbufcb *cbctx,char *buf,size_t len){
 	torque_rxbuf *rxb = &cbctx->rxbuf;
+	torque_rxbuf view;
+	const char *res;
+	size_t valid;
+	int cb;
 
-	// FIXME very likely incomplete
-	if(txback(rxb,fd,cbstate)){
-		close(fd);
+	if(rxb->buffer){
+		size_t space;
+
+		while(rxbuffer_space(rxb,&space),space < len){
+			if(growrxbuf(rxb)){
+				return -1;
+			}
+		}
+		if(len){
+			memcpy(rxbuffer_space(rxb,&space),buf,len);
+			rxbuffer_fill(rxb,len);
+		}
+		if( (cb = rxb->rx(fd,rxb,cbctx)) ){
+			return 1;
+		}
+		rxbuffer_release(rxb);
+		return 0;
+	}
+	view = *rxb;
+	view.buffer = buf;
+	view.buftot = view.bufoff = len;
+	view.bufate = 0;
+	if( (cb = view.rx(fd,&view,cbctx)) ){
+		return 1;
 	}
-	return;
+	res = rxbuffer_valid(&view,&valid);
+	if(valid == 0){
+		return 0;
+	}
+	return rxbuffer_hold(rxb,res,valid);
 }
 
+// Connections without residual input read into the thread's scratch buffer,
+// presented in place; those with it read directly into their own storage.
+// Output queued by the callbacks is written once the fd's input is exhausted.
 void buffered_rxfxn(int fd,void *cbstate){
 	torque_rxbufcb *cbctx = cbstate;
 	torque_rxbuf *rxb = &cbctx->rxbuf;
 	int r;
 
+	if(timeouts_enter(&cbctx->to,EVREAD)){
+		buffered_expire(fd,cbctx);
+		return;
+	}
 	for( ; ; ){
-		if(rxb->buftot - rxb->bufoff == 0){
-			int cb;
+		size_t space;
+		char *buf;
 
-			if( (cb = rxback(rxb,fd,cbstate)) ){
-				return;
+		if(rxb->buffer == NULL){
+			if((buf = rxscratch(get_thread_evh(),&space)) == NULL){
+				break;
 			}
-			if(rxb->buftot - rxb->bufoff == 0){
-				if(growrxbuf(rxb)){
-					break;
+		}else{
+			if(rxb->bufoff - rxb->bufate == rxb->buftot){
+				int cb;
+
+				if( (cb = rxback(rxb,fd,cbstate)) ){
+					buffered_done(fd,cbctx);
+					return;
+				}
+				if(rxb->bufoff - rxb->bufate == rxb->buftot){
+					if(growrxbuf(rxb)){
+						break;
+					}
 				}
 			}
+			buf = rxbuffer_space(rxb,&space);
 		}
-		if((r = read(fd,rxb->buffer + rxb->bufoff,rxb->buftot - rxb->bufoff)) > 0){
-			rxb->bufoff += r;
+		if((r = read(fd,buf,space)) > 0){
+			if(rxb->buffer == NULL){
+				int cb;
+
+				if( (cb = rxview(fd,cbctx,buf,r)) ){
+					if(cb < 0){
+						break;
+					}
+					buffered_done(fd,cbctx);
+					return;
+				}
+			}else{
+				rxbuffer_fill(rxb,r);
+			}
 		}else if(r == 0){
 			int cb;
 
+			cbctx->rxdone = 1; // before the callback (see framed_rxfxn())
 			if( (cb = rxb->rx(fd,rxb,cbstate)) ){
+				buffered_done(fd,cbctx);
 				return;
 			}
-			if(restorefd(get_thread_evh(),fd,EVWRITE)){
+			if(buffered_rearm(cbctx,fd)){
 				break;
 			}
 			return;
@@ -81,10 +347,11 @@ void buffered_rxfxn(int fd,void *cbstate){
 			int cb;
 
 			if( (cb = rxback(rxb,fd,cbstate)) ){
+				buffered_done(fd,cbctx);
 				return;
 			}
-			// FIXME sometimes we'll need EVWRITE as well!
-			if(restorefd(get_thread_evh(),fd,EVREAD)){
+			rxbuffer_release(rxb);
+			if(buffered_rearm(cbctx,fd)){
 				break;
 			}
 			return;
@@ -93,5 +360,489 @@ void buffered_rxfxn(int fd,void *cbstate){
 		}
 	}
 	// On any internal error, we're responsible for closing the fd.
-	close(fd);
+	buffered_close(fd,cbctx);
+}
+
+// Input already received elsewhere (ie, into an io_uring provided buffer) is
+// presented in place, unless residual input is being held for the connection,
+// in which case it's appended thereto. Whatever the callback doesn't release
+// is copied aside, the buffer reverting to its owner upon our return.
+int buffered_rxview(int fd,torque_rxbufcb *cbctx,char *buf,size_t len){
+	int cb;
+
+	if((cb = rxview(fd,cbctx,buf,len)) < 0){
+		close(fd);
+	}
+	return cb;
+}
+
+// err is only reported for files; referenced memory is simply released.
+static void
+release_txseg(txseg *ts,int err){
+	if(ts->data == NULL){
+		if(ts->sentfxn){
+			ts->sentfxn(ts->filefd,ts->sent,err,ts->relarg);
+		}
+	}else if(ts->relfxn){
+		ts->relfxn(ts->ref,ts->reflen,ts->relarg);
+	}
+	free(ts);
+}
+
+// The segment is unlinked before its release callback, which might queue
+// further output.
+static void
+txbuffer_pop(torque_txbuf *txb,int err){
+	txseg *ts = txb->head;
+
+	if((txb->head = ts->next) == NULL){
+		txb->tail = &txb->head;
+	}
+	txb->queued -= ts->len;
+	if(ts->zcpending && err == 0){
+		ts->next = NULL;
+		*txb->zcwaittail = ts;
+		txb->zcwaittail = &ts->next;
+		return;
+	}
+	release_txseg(ts,err);
+}
+
+// The head segment (should it be a file) is reported as having failed with
+// err, and anything behind it as canceled.
+static void
+txbuffer_fail(torque_txbuf *txb,int err){
+	txseg *ts;
+
+	while(txb->head){
+		txbuffer_pop(txb,err);
+		err = ECANCELED;
+	}
+	while( (ts = txb->zcwait) ){
+		txb->zcwait = ts->next;
+		release_txseg(ts,0);
+	}
+	txb->zcwaittail = &txb->zcwait;
+	txb->above = 0;
+}
+
+void discard_txbuffer(torque_txbuf *txb){
+	txbuffer_fail(txb,ECANCELED);
+}
+
+static void
+txbuffer_grew(torque_txbuf *txb,size_t len){
+	txb->queued += len;
+	if(txb->hiwat && !txb->above && txb->queued >= txb->hiwat){
+		txb->above = 1;
+		if(txb->hifxn){
+			txb->hifxn(txb->fd,txb,txb->cbstate);
+		}
+	}
+}
+
+static void
+txbuffer_append(torque_txbuf *txb,txseg *ts){
+	ts->next = NULL;
+	*txb->tail = ts;
+	txb->tail = &ts->next;
+	txbuffer_grew(txb,ts->len);
+}
+
+static void
+txbuffer_written(torque_txbuf *txb,size_t w){
+	while(w){
+		txseg *ts = txb->head;
+
+		if(w < ts->len){
+			if(ts->data){
+				ts->data += w;
+			}else{
+				ts->off += w;
+				ts->sent += w;
+			}
+			ts->len -= w;
+			txb->queued -= w;
+			break;
+		}
+		w -= ts->len;
+		if(ts->data == NULL){
+			ts->sent += ts->len;
+		}
+		txbuffer_pop(txb,0);
+	}
+	if(txb->above && txb->queued <= txb->lowat){
+		txb->above = 0;
+		if(txb->lofxn){
+			txb->lofxn(txb->fd,txb,txb->cbstate);
+		}
+	}
+}
+
+// Files which sendfile() refuses (it wants an mmap()able source, and on
+// FreeBSD a socket destination) are bounced through the thread's scratch
+// buffer. Bytes read but not written are simply read again. Returns the bytes
+// written, 0 if the file's ended, or -1 with errno set.
+static ssize_t
+txfile_send(torque_txbuf *txb,txseg *ts){
+	evhandler *evh;
+	size_t space;
+	ssize_t r,w;
+	char *buf;
+
+	if(!ts->bounce){
+#ifdef TORQUE_LINUX
+		off_t off = ts->off;
+
+		if((r = sendfile(txb->fd,ts->filefd,&off,ts->len)) >= 0){
+			return r;
+		}
+#elif defined(TORQUE_FREEBSD)
+		off_t sbytes = 0;
+
+		if(sendfile(ts->filefd,txb->fd,ts->off,ts->len,NULL,&sbytes,0) == 0
+				|| (errno == EAGAIN && sbytes)){
+			return sbytes;
+		}
+#else
+		errno = ENOSYS;
+#endif
+		if(errno != EINVAL && errno != ENOSYS && errno != ENOTSOCK &&
+				errno != EOPNOTSUPP){
+			return -1;
+		}
+		ts->bounce = 1;
+	}
+	if((evh = get_thread_evh()) == NULL || (buf = rxscratch(evh,&space)) == NULL){
+		errno = ENOMEM;
+		return -1;
+	}
+	if(space > ts->len){
+		space = ts->len;
+	}
+	if((r = pread(ts->filefd,buf,space,ts->off)) <= 0){
+		return r;
+	}
+	if((w = write(txb->fd,buf,r)) == 0){
+		errno = EAGAIN;
+		return -1;
+	}
+	return w;
+}
+
+static inline int
+txseg_zerocopies(const torque_txbuf *txb,const txseg *ts){
+	return txb->zcthresh && ts->data && ts->len >= txb->zcthresh;
+}
+
+#ifdef TORQUE_LINUX_ZEROCOPY
+// The segment's sends are numbered contiguously, it being written in full
+// before any other segment is sent zerocopy.
+static void
+zcseg_complete(txseg *ts,uint32_t lo,uint32_t hi){
+	uint32_t z;
+
+	for(z = ts->zcfirst ; ; ++z){
+		if((uint32_t)(z - lo) <= (uint32_t)(hi - lo)){
+			--ts->zcpending;
+		}
+		if(z == ts->zclast){
+			break;
+		}
+	}
+}
+
+// Sends lo through hi are complete.
+static void
+txbuffer_zcdone(torque_txbuf *txb,uint32_t lo,uint32_t hi){
+	txseg **pts,*ts;
+
+	if(txb->head && txb->head->zcpending){
+		zcseg_complete(txb->head,lo,hi);
+	}
+	pts = &txb->zcwait;
+	while( (ts = *pts) ){
+		zcseg_complete(ts,lo,hi);
+		if(ts->zcpending == 0){
+			if((*pts = ts->next) == NULL){
+				txb->zcwaittail = pts;
+			}
+			release_txseg(ts,0);
+		}else{
+			pts = &ts->next;
+		}
+	}
+}
+
+// Drain the socket's error queue of zerocopy completions. Anything else
+// queued there (ie, ICMP errors) is of no interest.
+static int
+txbuffer_reap(torque_txbuf *txb){
+	evhandler *evh = get_thread_evh();
+
+	while(txbuffer_zcwaiting(txb)){
+		char control[CMSG_SPACE(sizeof(struct sock_extended_err) +
+					sizeof(struct sockaddr_in6))];
+		struct cmsghdr *cm;
+		struct msghdr msg;
+
+		memset(&msg,0,sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if(recvmsg(txb->fd,&msg,MSG_ERRQUEUE) < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK){
+				break;
+			}else if(errno != EINTR){
+				return -1;
+			}
+			continue;
+		}
+		for(cm = CMSG_FIRSTHDR(&msg) ; cm ; cm = CMSG_NXTHDR(&msg,cm)){
+			struct sock_extended_err ee;
+
+			if(!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+				!(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)){
+				continue;
+			}
+			memcpy(&ee,CMSG_DATA(cm),sizeof(ee));
+			if(ee.ee_errno || ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY){
+				continue;
+			}
+			if(evh && (ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)){
+				++evh->stats.zccopied;
+			}
+			txbuffer_zcdone(txb,ee.ee_info,ee.ee_data);
+		}
+	}
+	return 0;
+}
+
+// Past the socket's optmem limit, the kernel can't pin further pages, and
+// refuses with ENOBUFS; we copy instead.
+static ssize_t
+txseg_zerocopy(torque_txbuf *txb,txseg *ts){
+	evhandler *evh;
+	ssize_t r;
+
+	if((r = send(txb->fd,ts->data,ts->len,MSG_ZEROCOPY)) < 0){
+		if(errno == ENOBUFS){
+			r = send(txb->fd,ts->data,ts->len,0);
+		}
+		return r;
+	}
+	if(ts->zcpending++ == 0){
+		ts->zcfirst = txb->zcseq;
+	}
+	ts->zclast = txb->zcseq++;
+	if( (evh = get_thread_evh()) ){
+		++evh->stats.zcsends;
+	}
+	return r;
+}
+#endif
+
+// The low watermark's callback might queue further output, which we continue
+// to write; the queue is thus only ever left non-empty with the fd full.
+// Memory is gathered up to the first file (or segment to be sent zerocopy),
+// which is then sent on its own.
+int txbuffer_flush(torque_txbuf *txb){
+#ifdef TORQUE_LINUX_ZEROCOPY
+	if(txbuffer_reap(txb)){
+		int e = errno;
+
+		txbuffer_fail(txb,e);
+		errno = e;
+		return -1;
+	}
+#endif
+	while(txb->head){
+		struct iovec iov[TXBUF_IOV];
+		const txseg *ts;
+		ssize_t r;
+		int n = 0;
+
+		if(txb->head->data == NULL){
+			if((r = txfile_send(txb,txb->head)) == 0){
+				txbuffer_pop(txb,0); // the file ended early
+				txbuffer_written(txb,0);
+				continue;
+			}
+		}
+#ifdef TORQUE_LINUX_ZEROCOPY
+		else if(txseg_zerocopies(txb,txb->head)){
+			r = txseg_zerocopy(txb,txb->head);
+		}
+#endif
+		else{
+			for(ts = txb->head ; ts && ts->data && n < TXBUF_IOV ; ts = ts->next){
+				if(n && txseg_zerocopies(txb,ts)){
+					break;
+				}
+				iov[n].iov_base = (void *)(uintptr_t)ts->data; // unmodified
+				iov[n].iov_len = ts->len;
+				++n;
+			}
+			r = writev(txb->fd,iov,n);
+		}
+		if(r < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK){
+				break;
+			}else if(errno != EINTR){
+				int e = errno;
+
+				txbuffer_fail(txb,e);
+				errno = e;
+				return -1;
+			}
+			continue;
+		}
+		txbuffer_written(txb,r);
+	}
+	return 0;
+}
+
+torque_txbuf *torque_gettxbuf(torque_rxbuf *rxb){
+	return rxb->txb;
+}
+
+// Copies are appended to the last segment while it has room.
+torque_err torque_txcopy(torque_txbuf *txb,const void *buf,size_t len){
+	size_t cap;
+	txseg *ts;
+
+	if(len == 0){
+		return 0;
+	}
+	if(txb->head){
+		ts = (txseg *)((char *)txb->tail - offsetof(txseg,next));
+		if(ts->relfxn == NULL && ts->room >= len){
+			memcpy(ts->buf + (ts->data - ts->buf) + ts->len,buf,len);
+			ts->len += len;
+			ts->room -= len;
+			txbuffer_grew(txb,len);
+			return 0;
+		}
+	}
+	cap = TXSEG_SIZE - sizeof(*ts);
+	if(len > cap){
+		cap = len;
+	}
+	if((ts = malloc(sizeof(*ts) + cap)) == NULL){
+		return TORQUE_ERR_RESOURCE;
+	}
+	memcpy(ts->buf,buf,len);
+	ts->data = ts->buf;
+	ts->len = len;
+	ts->room = cap - len;
+	ts->relfxn = NULL;
+	ts->zcpending = 0;
+	txbuffer_append(txb,ts);
+	return 0;
+}
+
+torque_err torque_txref(torque_txbuf *txb,const void *buf,size_t len,
+				libtorquerelcb relfxn,void *relarg){
+	txseg *ts;
+
+	if(len == 0 || (ts = malloc(sizeof(*ts))) == NULL){
+		if(relfxn){
+			relfxn(buf,len,relarg);
+		}
+		return len ? TORQUE_ERR_RESOURCE : 0;
+	}
+	ts->data = buf;
+	ts->len = len;
+	ts->room = 0;
+	ts->relfxn = relfxn;
+	ts->ref = buf;
+	ts->reflen = len;
+	ts->relarg = relarg;
+	ts->zcpending = 0;
+	txbuffer_append(txb,ts);
+	return 0;
+}
+
+// sentfxn is called even if queueing fails, so that the file can be closed.
+torque_err torque_sendfile(torque_txbuf *txb,int filefd,off_t off,size_t len,
+				libtorquesentcb sentfxn,void *sentarg){
+	txseg *ts;
+
+	if(len == 0){
+		struct stat st;
+
+		if(fstat(filefd,&st)){
+			int e = errno;
+
+			if(sentfxn){
+				sentfxn(filefd,0,e,sentarg);
+			}
+			return TORQUE_ERR_SYSCALL + e;
+		}
+		if(st.st_size > off){
+			len = st.st_size - off;
+		}
+	}
+	if(len == 0 || (ts = malloc(sizeof(*ts))) == NULL){
+		if(sentfxn){
+			sentfxn(filefd,0,len ? ENOMEM : 0,sentarg);
+		}
+		return len ? TORQUE_ERR_RESOURCE : 0;
+	}
+	ts->data = NULL;
+	ts->len = len;
+	ts->room = 0;
+	ts->relfxn = NULL;
+	ts->sentfxn = sentfxn;
+	ts->relarg = sentarg;
+	ts->zcpending = 0;
+	ts->filefd = filefd;
+	ts->bounce = 0;
+	ts->off = off;
+	ts->sent = 0;
+	txbuffer_append(txb,ts);
+	return 0;
+}
+
+torque_err torque_txflush(torque_txbuf *txb){
+	if(txbuffer_flush(txb)){
+		return TORQUE_ERR_SYSCALL + errno;
+	}
+	return 0;
+}
+
+torque_err torque_txzerocopy(torque_txbuf *txb,size_t thresh){
+#ifdef TORQUE_LINUX_ZEROCOPY
+	int on = 1;
+
+	if(thresh && !txb->zcthresh &&
+			setsockopt(txb->fd,SOL_SOCKET,SO_ZEROCOPY,&on,sizeof(on))){
+		return TORQUE_ERR_SYSCALL + errno;
+	}
+	txb->zcthresh = thresh;
+	return 0;
+#else
+	(void)txb;
+	return thresh ? TORQUE_ERR_UNAVAIL : 0;
+#endif
+}
+
+size_t torque_txqueued(const torque_txbuf *txb){
+	return txb->queued;
+}
+
+torque_err torque_txwatermarks(torque_txbuf *txb,size_t lowat,size_t hiwat,
+				libtorquewmcb lofxn,libtorquewmcb hifxn){
+	if(hiwat && lowat >= hiwat){
+		return TORQUE_ERR_INVAL;
+	}
+	txb->lowat = lowat;
+	txb->hiwat = hiwat;
+	txb->lofxn = lofxn;
+	txb->hifxn = hifxn;
+	txb->above = hiwat && txb->queued >= hiwat;
+	return 0;
+}
+
+void torque_txclose(torque_txbuf *txb){
+	txb->closing = 1;
 }
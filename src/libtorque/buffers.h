@@ -9,81 +9,191 @@ extern "C" {
 #include <string.h>
 #include <libtorque/alloc.h>
 #include <libtorque/internal.h>
+#include <libtorque/timeouts.h>
+
+// A segment of queued output: either copied into the segment, which further
+// output can be appended to while it has room, referencing the client's
+// memory until it's been written, or a span of a file (data is then NULL),
+// sent without passing through userspace (see torque_sendfile()).
+typedef struct txseg {
+	struct txseg *next;
+	const char *data;		// unwritten output
+	size_t len;			// its length
+	size_t room;			// space for appended copies
+	libtorquerelcb relfxn;		// NULL for copied output
+	const void *ref;		// referenced output, as queued
+	size_t reflen;
+	void *relarg;
+	unsigned zcpending;		// zerocopy sends awaiting completion
+	uint32_t zcfirst,zclast;	// ...numbered thusly (inclusive)
+	libtorquesentcb sentfxn;	// files only, as are the remainder
+	int filefd;
+	int bounce;			// sendfile() refused; read and write
+	off_t off;			// next offset to be sent
+	size_t sent;
+	char buf[];			// copied output
+} txseg;
+
+// A TX queue (see torque_gettxbuf()): a chain of segments, gathered by
+// writev(2) up to TXBUF_IOV at a time. With zerocopy enabled, segments of at
+// least zcthresh bytes are instead sent alone with MSG_ZEROCOPY. The kernel
+// numbers such sends per socket, and reports their completion in ranges on
+// the socket's error queue. Segments written in full, but with sends yet
+// incomplete, wait on the zcwait list before being released.
+#define TXBUF_IOV	64
+#define TXSEG_SIZE	4096		// copied segments, including their header
+
+typedef struct torque_txbuf {
+	txseg *head,**tail;
+	size_t queued;			// bytes not yet written
+	size_t lowat,hiwat;		// see torque_txwatermarks()
+	libtorquewmcb lofxn,hifxn;
+	int above;			// hiwat reached, lowat not since
+	int closing;			// close once written (torque_txclose())
+	int fd;
+	void *cbstate;			// userspace callback state
+	size_t zcthresh;		// 0 unless zerocopy is enabled
+	uint32_t zcseq;			// number of the next zerocopy send
+	txseg *zcwait,**zcwaittail;
+} torque_txbuf;
 
-// This is the simplest possible RX buffer; fixed-length, one piece, not even
-// circular (ie, fixed length on connection!). It'll be replaced.
+static inline void
+init_txbuffer(torque_txbuf *txb,int fd,void *cbstate){
+	memset(txb,0,sizeof(*txb));
+	txb->tail = &txb->head;
+	txb->zcwaittail = &txb->zcwait;
+	txb->fd = fd;
+	txb->cbstate = cbstate;
+}
+
+// Write what the fd will take. Returns -1 (having discarded the queue) on
+// any error other than the fd's being full.
+int txbuffer_flush(torque_txbuf *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
+// Output written, but awaiting zerocopy completion.
+static inline int
+txbuffer_zcwaiting(const torque_txbuf *txb){
+	return txb->zcwait || (txb->head && txb->head->zcpending);
+}
+
+// Free the queue, releasing referenced output (including that awaiting
+// zerocopy completion: the fd is presumably being closed).
+void discard_txbuffer(torque_txbuf *)
+	__attribute__ ((nonnull(1)));
+
+// A circular RX buffer. Its buftot bytes of memory are mapped twice in
+// succession (see get_ring()), so the valid input, and the free space
+// following it, are each contiguous wherever they wrap: the input is never
+// moved. bufate is kept within [0, buftot), and bufoff within buftot of it.
 typedef struct torque_rxbuf {
-	char *buffer;			// always points to the buffer's start
-	size_t buftot;			// length of the buffer
-	size_t bufoff;			// how far we've dirtied the buffer
-	size_t bufate;			// how much input the client's released
+	char *buffer;			// start of the first of two mappings
+	size_t buftot;			// length of the ring (of each mapping)
+	size_t bufoff;			// where input is next received
+	size_t bufate;			// start of input the client's not released
 	libtorquebrcb rx;		// inner rx callback
 	libtorquebwcb tx;		// inner tx callback
+	torque_txbuf *txb;		// see torque_gettxbuf(), NULL if none
 } torque_rxbuf;
 
+// Buffered fds read into their event thread's scratch buffer (see
+// evhandler), and only hold storage of their own while their callbacks leave
+// input unreleased; an idle connection holds no buffer. Storage is sized to
+// the residual input, grown as it accumulates, and returned once drained.
 typedef struct torque_rxbufcb {
 	torque_rxbuf rxbuf;
+	torque_txbuf txbuf;
 	void *cbstate;			// userspace callback
+	conn_timeouts to;		// see torque_addfd_timeouts()
+	void *rxproto;			// protocol state (ie framing), or NULL
+	int rxdone;			// input has ended
+	int closed;			// the fd's been closed
+	struct torque_rxbufcb *reclaimnext; // see reclaim_rxbuffercbs()
 } torque_rxbufcb;
 
-// The simplest receive buffer.
+// Release s bytes of input. An emptied ring restarts at its beginning.
 static inline void
 rxbuffer_advance(torque_rxbuf *rxb,size_t s){
-	if((rxb->bufate += s) == rxb->buftot){
+	if((rxb->bufate += s) == rxb->bufoff){
 		rxb->bufoff = rxb->bufate = 0;
-	}else if(rxb->bufoff == rxb->buftot){
-		memmove(rxb->buffer,rxb->buffer + rxb->bufate,
-				rxb->bufoff - rxb->bufate);
-		rxb->bufoff -= rxb->bufate;
-		rxb->bufate = 0;
-	} // FIXME very slow, doesn't reclaim memory, sucky in general
+	}else if(rxb->bufate >= rxb->buftot){
+		rxb->bufate -= rxb->buftot;
+		rxb->bufoff -= rxb->buftot;
+	}
+}
+
+// Contiguous space for input, and its length.
+static inline char *
+rxbuffer_space(const torque_rxbuf *rxb,size_t *space){
+	*space = rxb->buftot - (rxb->bufoff - rxb->bufate);
+	return rxb->buffer + rxb->bufoff;
+}
+
+static inline void
+rxbuffer_fill(torque_rxbuf *rxb,size_t s){
+	rxb->bufoff += s;
 }
 
 static inline int initialize_rxbuffer(const struct torque_ctx *,torque_rxbuf *)
 	__attribute__ ((warn_unused_result))
 	__attribute__ ((nonnull(1,2)));
 
+// For rxbufs outside of a torque_rxbufcb (ie, SSL's), lacking a TX queue.
 static inline int
 initialize_rxbuffer(const struct torque_ctx *ctx,torque_rxbuf *rxb){
-	if( (rxb->buffer = get_big_page(ctx,&rxb->buftot)) ){
+	if( (rxb->buffer = get_big_ring(ctx,&rxb->buftot)) ){
 		rxb->bufoff = rxb->bufate = 0;
+		rxb->txb = NULL;
 		return 0;
 	}
 	return -1;
 }
 
-static inline torque_rxbufcb *create_rxbuffercb(struct torque_ctx *,
+static inline void
+init_rxbuffercb(torque_rxbufcb *rxcb,int fd,libtorquebrcb rx,libtorquebwcb tx,
+		void *cbstate){
+	memset(&rxcb->rxbuf,0,sizeof(rxcb->rxbuf));
+	rxcb->rxbuf.rx = rx;
+	rxcb->rxbuf.tx = tx;
+	rxcb->rxbuf.txb = &rxcb->txbuf;
+	init_txbuffer(&rxcb->txbuf,fd,cbstate);
+	rxcb->cbstate = cbstate;
+	rxcb->to.timer = NULL;
+	rxcb->rxproto = NULL;
+	rxcb->rxdone = rxcb->closed = 0;
+}
+
+static inline torque_rxbufcb *create_rxbuffercb(struct torque_ctx *,int,
 				libtorquebrcb,libtorquebwcb,void *)
 	__attribute__ ((warn_unused_result))
 	__attribute__ ((nonnull(1)))
 	__attribute__ ((malloc));
 
 static inline torque_rxbufcb *
-create_rxbuffercb(struct torque_ctx *ctx,libtorquebrcb rx,libtorquebwcb tx,
-					void *cbstate){
+create_rxbuffercb(struct torque_ctx *ctx __attribute__ ((unused)),int fd,
+		libtorquebrcb rx,libtorquebwcb tx,void *cbstate){
 	torque_rxbufcb *ret;
 
 	if( (ret = malloc(sizeof(*ret))) ){
-		if(initialize_rxbuffer(ctx,&ret->rxbuf) == 0){
-			ret->rxbuf.rx = rx;
-			ret->rxbuf.tx = tx;
-			ret->cbstate = cbstate;
-			return ret;
-		}
-		free(ret);
-		ret = NULL;
+		init_rxbuffercb(ret,fd,rx,tx,cbstate);
 	}
 	return ret;
 }
 
 static inline void
 free_rxbuffer(torque_rxbuf *rxb){
-	dealloc(rxb->buffer,rxb->buftot);
+	put_ring(rxb->buffer,rxb->buftot);
 }
 
 static inline void
 free_rxbuffercb(torque_rxbufcb *rxb){
-	free_rxbuffer(&rxb->rxbuf);
+	if(rxb->rxbuf.buffer){
+		free_rxbuffer(&rxb->rxbuf);
+	}
+	discard_txbuffer(&rxb->txbuf);
+	free(rxb->rxproto);
+	rxb->rxproto = NULL;
 }
 
 static inline const char *
@@ -95,14 +205,32 @@ rxbuffer_valid(const torque_rxbuf *rxb,size_t *valid){
 void buffered_txfxn(int,void *) __attribute__ ((nonnull(2)));
 void buffered_rxfxn(int,void *) __attribute__ ((nonnull(2)));
 
+// Deliver len bytes of input from buf, which the caller retains, to the
+// buffered callback. Non-zero if the fd is no longer ours: the callback
+// returned non-zero, or we closed the fd following an internal error.
+int buffered_rxview(int,torque_rxbufcb *,char *,size_t)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(2)));
+
+// Free the event thread's scratch buffer, if any (see buffered_rxfxn()).
+void free_rxscratch(struct evhandler *)
+	__attribute__ ((nonnull(1)));
+
+// Free the state of buffered fds closed by their callbacks during the round.
+void reclaim_rxbuffercbs(struct evhandler *)
+	__attribute__ ((nonnull(1)));
+
 #ifndef torque_WITHOUT_SSL
 #include <openssl/ssl.h>
 static inline int
 rxbuffer_ssl(torque_rxbuf *rxb,SSL *s){
+	size_t space;
+	char *buf;
 	int r;
 
-	if((r = SSL_read(s,rxb->buffer + rxb->bufate,rxb->buftot - rxb->bufoff)) > 0){
-		rxb->bufoff += r;
+	buf = rxbuffer_space(rxb,&space);
+	if((r = SSL_read(s,buf,space)) > 0){
+		rxbuffer_fill(rxb,r);
 	}
 	return r;
 }
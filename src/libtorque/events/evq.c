@@ -1,15 +1,38 @@
+#include <limits.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <libtorque/protos/dns.h>
 #include <libtorque/events/evq.h>
+#include <libtorque/events/post.h>
+#include <libtorque/events/timer.h>
+#include <libtorque/events/uring.h>
 #include <libtorque/events/thread.h>
 #include <libtorque/events/signal.h>
 
 int destroy_evqueue(evqueue *evq){
 	int ret = 0;
 
+	if(evq->postq){
+		ret |= destroy_postq(evq->postq);
+		evq->postq = NULL;
+	}
+	if(evq->wheel){
+		ret |= destroy_twheel(evq->wheel);
+		evq->wheel = NULL;
+	}
+#ifdef TORQUE_LINUX_URING
+	if(evq->ring){
+		ret |= destroy_uring(evq->ring);
+		evq->ring = NULL;
+	}else
+#endif
 	ret |= close(evq->efd);
 	evq->efd = -1;
+	if(evq->lf){
+		ret |= destroy_evleader(evq->lf);
+		evq->lf = NULL;
+	}
 	torque_dns_shutdown(&evq->dnsctx);
 	return ret;
 }
@@ -35,6 +58,11 @@ add_commonfds_to_evhandler(int fd,evqueue *evq){
 	// else, putting it on an event queue, and then swapping the exit back
 	// in from some other queue). So no EPOLLET.
 	ee.events = EVREAD;
+#ifdef TORQUE_LINUX_URING
+	if(evq->ring){
+		return uring_add(evq,fd,ee.events);
+	}
+#endif
 	k.events = &ee;
 	k.ctldata = &ecd;
 	ecd.op = EPOLL_CTL_ADD;
@@ -70,17 +98,146 @@ add_evqueue_baseevents(torque_ctx *ctx,evqueue *e){
 }
 
 int init_evqueue(torque_ctx *ctx,evqueue *e){
+	e->package = e->core = UINT_MAX;
+	e->threads = 0;
+	e->l1dsize = 0;
+	e->lf = NULL;
+	e->wheel = NULL;
+	e->postq = NULL;
+	CPU_ZERO(&e->cpus);
+	e->next = NULL;
 	if(torque_dns_init(&e->dnsctx)){
 		return -1;
 	}
+#ifdef TORQUE_LINUX_URING
+	e->ring = NULL;
+	e->efd = -1;
+	if(ctx->opts.evbackend == TORQUE_BACKEND_URING){
+		// Should the kernel not support io_uring, the context's first
+		// evqueue reverts the context to the native backend. Failure
+		// thereafter is a simple lack of resources.
+		if((e->ring = create_uring()) == NULL){
+			if(e != &ctx->evq){
+				torque_dns_shutdown(&e->dnsctx);
+				return -1;
+			}
+			ctx->opts.evbackend = TORQUE_BACKEND_NATIVE;
+		}
+	}
+	if(e->ring == NULL)
+#endif
 	if((e->efd = create_efd()) < 0){
 		torque_dns_shutdown(&e->dnsctx);
 		return -1;
 	}
+	// Private evqueues have but one waiter.
+	if(ctx->opts.leaderfollower && ctx->opts.evqmode != TORQUE_EVQ_THREAD){
+		if((e->lf = create_evleader()) == NULL){
+			destroy_evqueue(e);
+			return -1;
+		}
+	}
 	if(add_evqueue_baseevents(ctx,e)){
-		close(e->efd);
-		torque_dns_shutdown(&e->dnsctx);
+		destroy_evqueue(e);
+		return -1;
+	}
+	if((e->wheel = create_twheel(ctx,e)) == NULL){
+		destroy_evqueue(e);
+		return -1;
+	}
+	if((e->postq = create_postq(ctx,e)) == NULL){
+		destroy_evqueue(e);
 		return -1;
 	}
 	return 0;
 }
+
+int destroy_evqueues(torque_ctx *ctx){
+	int ret = 0;
+
+	while(ctx->evq.next){
+		evqueue *e = ctx->evq.next;
+
+		ctx->evq.next = e->next;
+		ret |= destroy_evqueue(e);
+		free(e);
+	}
+	ctx->evqcount = 1;
+	ret |= destroy_evqueue(&ctx->evq);
+	return ret;
+}
+
+// The context's evq is claimed by the first group to ask for an evqueue;
+// other groups get their own, chained from it. Core IDs are only unique within
+// a package, so the group is identified by both. Private evqueues are never
+// shared, and thus never looked up.
+evqueue *get_group_evqueue(torque_ctx *ctx,unsigned pkg,unsigned core){
+	evqueue *e;
+
+	if(ctx->opts.evqmode == TORQUE_EVQ_SHARED){
+		return &ctx->evq;
+	}
+	if(ctx->opts.evqmode == TORQUE_EVQ_PACKAGE){
+		core = 0;
+	}
+	if(ctx->opts.evqmode != TORQUE_EVQ_THREAD){
+		for(e = &ctx->evq ; e ; e = e->next){
+			if(e->package == pkg && e->core == core){
+				return e;
+			}
+		}
+	}
+	if(ctx->evq.package == UINT_MAX){
+		e = &ctx->evq;
+	}else{
+		if((e = malloc(sizeof(*e))) == NULL){
+			return NULL;
+		}
+		if(init_evqueue(ctx,e)){
+			free(e);
+			return NULL;
+		}
+		e->next = ctx->evq.next;
+		ctx->evq.next = e;
+		++ctx->evqcount;
+	}
+	e->package = pkg;
+	e->core = core;
+	return e;
+}
+
+// Event threads register sources on their own evqueue, keeping the source's
+// events within the registering scheduling group. Other threads have no such
+// locality, and distribute their sources among the evqueues.
+const evqueue *local_evqueue(torque_ctx *ctx){
+	const evhandler *evh;
+	const evqueue *e;
+	unsigned n;
+
+	if(ctx->evq.next == NULL){
+		return &ctx->evq;
+	}
+	if(get_thread_ctx() == ctx && (evh = get_thread_evh())){
+		return evh->evq;
+	}
+	n = __sync_fetch_and_add(&ctx->evqrr,1) % ctx->evqcount;
+	e = &ctx->evq;
+	while(n--){
+		e = e->next;
+	}
+	return e;
+}
+
+const evqueue *aid_evqueue(const torque_ctx *ctx,unsigned aid){
+	const evqueue *e;
+
+	if(aid >= CPU_SETSIZE){
+		return NULL;
+	}
+	for(e = &ctx->evq ; e ; e = e->next){
+		if(CPU_ISSET(aid,&e->cpus)){
+			return e;
+		}
+	}
+	return NULL;
+}
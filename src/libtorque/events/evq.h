@@ -15,6 +15,27 @@ int init_evqueue(struct torque_ctx *,struct evqueue *)
 int destroy_evqueue(struct evqueue *)
 	__attribute__ ((nonnull(1)));
 
+// Destroy all evqueues of the context, including those chained from its evq.
+int destroy_evqueues(struct torque_ctx *)
+	__attribute__ ((nonnull(1)));
+
+// Look up the evqueue serving the specified scheduling group, creating it if
+// necessary. Only to be called while initializing the context.
+struct evqueue *get_group_evqueue(struct torque_ctx *,unsigned,unsigned)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
+// The evqueue upon which a new event source ought be registered.
+const struct evqueue *local_evqueue(struct torque_ctx *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
+// The evqueue upon which the specified processor's event thread waits, or
+// NULL if there's no such thread.
+const struct evqueue *aid_evqueue(const struct torque_ctx *,unsigned)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
 #ifdef __cplusplus
 }
 #endif
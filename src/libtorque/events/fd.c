@@ -1,6 +1,9 @@
+#include <errno.h>
 #include <string.h>
 #include <pthread.h>
+#include <sys/socket.h>
 #include <libtorque/events/fd.h>
+#include <libtorque/events/uring.h>
 #include <libtorque/events/sysdep.h>
 #include <libtorque/events/thread.h>
 #include <libtorque/events/sources.h>
@@ -12,7 +15,7 @@ add_fd_event(const evqueue *evq,int fd,libtorquercb rfxn,libtorquewcb tfxn,int e
 	struct epoll_event ee;
 	struct kevent k;
 
-	if(eflags & ~(EPOLLONESHOT)){ // enforce allowed eflags
+	if(eflags & ~(EPOLLONESHOT | EVEXCLUSIVE)){ // enforce allowed eflags
 		return -1;
 	}
 	memset(&ee.data,0,sizeof(ee.data));
@@ -20,6 +23,29 @@ add_fd_event(const evqueue *evq,int fd,libtorquercb rfxn,libtorquewcb tfxn,int e
 	ee.data.fd = fd;
 	k.ctldata = &ecd;
 	ecd.op = EPOLL_CTL_ADD;
+	// EPOLLEXCLUSIVE (Linux 4.5) wakes only one of the evqueues watching
+	// the fd, but admits only EPOLLIN, EPOLLOUT and EPOLLET alongside it.
+	// Older kernels reject it, whereupon we register as usual.
+#ifdef TORQUE_LINUX_URING
+	if(evq->ring){
+		eflags &= ~EVEXCLUSIVE;
+	}
+#endif
+	if(eflags & EVEXCLUSIVE){
+		ee.events = EPOLLET | EVEXCLUSIVE;
+		if(rfxn){
+			ee.events |= EPOLLIN;
+		}
+		if(tfxn){
+			ee.events |= EPOLLOUT;
+		}
+		if(Kevent(evq->efd,&k,1,NULL,0) == 0){
+			return 0;
+		}else if(errno != EINVAL){
+			return -1;
+		}
+		eflags &= ~EVEXCLUSIVE;
+	}
 	// We automatically wait for EPOLLERR/EPOLLHUP; according to
 	// epoll_ctl(2), "it is not necessary to add set [these] in ->events"
 	ee.events = EPOLLET | EPOLLPRI | eflags;
@@ -29,6 +55,11 @@ add_fd_event(const evqueue *evq,int fd,libtorquercb rfxn,libtorquewcb tfxn,int e
 	if(tfxn){
 		ee.events |= EVWRITE;
 	}
+#ifdef TORQUE_LINUX_URING
+	if(evq->ring){
+		return uring_add(evq,fd,ee.events);
+	}
+#endif
 	return Kevent(evq->efd,&k,1,NULL,0);
 #elif defined(TORQUE_FREEBSD)
 	struct kevent k[2];
@@ -47,14 +78,45 @@ add_fd_event(const evqueue *evq,int fd,libtorquercb rfxn,libtorquewcb tfxn,int e
 	return 0;
 }
 
-int add_fd_to_evhandler(torque_ctx *ctx,const evqueue *evq,int fd,
-			libtorquercb rfxn,libtorquewcb tfxn,
-			void *cbstate,int eflags){
+// SO_BUSY_POLL has the kernel spin on the device queue when reading from an
+// empty socket, complementing our own spinning. It's merely a hint, and fds
+// which aren't sockets fail harmlessly.
+void busypoll_fd(const torque_ctx *ctx,int fd){
+#ifdef SO_BUSY_POLL
+	if(ctx->opts.spinus && ctx->opts.busypoll){
+		int us = ctx->opts.spinus;
+
+		setsockopt(fd,SOL_SOCKET,SO_BUSY_POLL,&us,sizeof(us));
+	}
+#else
+	(void)ctx;
+	(void)fd;
+#endif
+}
+
+// Only one thread waits on a private evqueue, so its sources needn't be
+// one-shot; we remember the interest registered, so that restorefd() need
+// only modify the registration when that interest changes. Under io_uring,
+// rearms are batched into the wait anyway, and a persistent poll request
+// would keep a closed fd's file open, so sources remain one-shot.
+int add_fd_to_evhandler_armed(torque_ctx *ctx,const evqueue *evq,int fd,
+			libtorquercb rfxn,libtorquewcb tfxn,void *cbstate,
+			int eflags,torque_prio prio,int armtx){
+	libtorquewcb armed = armtx ? tfxn : NULL;
+
 	if((unsigned)fd >= ctx->eventtables.fdarraysize){
 		return -1;
 	}
 	setup_evsource(ctx->eventtables.fdarray,fd,rfxn,tfxn,cbstate);
-	if(add_fd_event(evq,fd,rfxn,tfxn,eflags)){
+	ctx->eventtables.fdarray[fd].prio = prio;
+	if(ctx->opts.evqmode == TORQUE_EVQ_THREAD &&
+			ctx->opts.evbackend != TORQUE_BACKEND_URING){
+		eflags &= ~EVONESHOT;
+		ctx->eventtables.fdarray[fd].armed =
+			(rfxn ? EVREAD : 0) | (armed ? EVWRITE : 0);
+	}
+	busypoll_fd(ctx,fd);
+	if(add_fd_event(evq,fd,rfxn,armed,eflags)){
 		return -1;
 	}
 	return 0;
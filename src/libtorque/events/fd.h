@@ -11,11 +11,41 @@ extern "C" {
 struct evectors;
 struct evhandler;
 
-int add_fd_to_evhandler(struct torque_ctx *,const struct evqueue *,int,
-			libtorquercb,libtorquewcb,void *,int)
+// Write interest is only registered if the final parameter is non-zero;
+// otherwise, the write callback awaits restorefd().
+int add_fd_to_evhandler_armed(struct torque_ctx *,const struct evqueue *,int,
+			libtorquercb,libtorquewcb,void *,int,torque_prio,int)
 	__attribute__ ((warn_unused_result))
 	__attribute__ ((nonnull (1,2)));
 
+static inline int add_fd_to_evhandler_prio(struct torque_ctx *,const struct evqueue *,
+			int,libtorquercb,libtorquewcb,void *,int,torque_prio)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull (1,2)));
+
+static inline int
+add_fd_to_evhandler_prio(struct torque_ctx *ctx,const struct evqueue *evq,int fd,
+			libtorquercb rfxn,libtorquewcb tfxn,void *cbstate,
+			int eflags,torque_prio prio){
+	return add_fd_to_evhandler_armed(ctx,evq,fd,rfxn,tfxn,cbstate,eflags,
+						prio,1);
+}
+
+static inline int add_fd_to_evhandler(struct torque_ctx *,const struct evqueue *,
+			int,libtorquercb,libtorquewcb,void *,int)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull (1,2)));
+
+static inline int
+add_fd_to_evhandler(struct torque_ctx *ctx,const struct evqueue *evq,int fd,
+			libtorquercb rfxn,libtorquewcb tfxn,void *cbstate,int eflags){
+	return add_fd_to_evhandler_prio(ctx,evq,fd,rfxn,tfxn,cbstate,eflags,
+						TORQUE_PRIO_NORMAL);
+}
+
+void busypoll_fd(const struct torque_ctx *,int)
+	__attribute__ ((nonnull (1)));
+
 #ifdef __cplusplus
 }
 #endif
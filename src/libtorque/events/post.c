@@ -0,0 +1,158 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libtorque/events/fd.h>
+#include <libtorque/events/post.h>
+#include <libtorque/events/sysdep.h>
+#include <libtorque/events/thread.h>
+
+static int
+ring_doorbell(const postq *pq){
+#ifdef TORQUE_LINUX_EVENTFD
+	uint64_t one = 1;
+	int fd = pq->fd;
+#else
+	char one = 0;
+	int fd = pq->wfd;
+#endif
+	ssize_t r;
+
+	while((r = write(fd,&one,sizeof(one))) < 0 && errno == EINTR){
+		;
+	}
+	// A saturated eventfd or full pipe is ringing already.
+	if(r < 0 && errno != EAGAIN && errno != EWOULDBLOCK){
+		return -1;
+	}
+	return 0;
+}
+
+static void
+clear_doorbell(const postq *pq){
+#ifdef TORQUE_LINUX_EVENTFD
+	uint64_t count;
+
+	while(read(pq->fd,&count,sizeof(count)) < 0 && errno == EINTR){
+		;
+	}
+#else
+	char buf[64];
+	ssize_t r;
+
+	while((r = read(pq->fd,buf,sizeof(buf))) > 0 || (r < 0 && errno == EINTR)){
+		;
+	}
+#endif
+}
+
+// The doorbell is cleared before the stack is taken, so a post made after the
+// exchange finds the stack empty, and rings anew; none are left unannounced.
+static void
+postq_rxfxn(int fd __attribute__ ((unused)),void *state){
+	evhandler *evh = get_thread_evh();
+	postq *pq = state;
+	posttask *t,*fifo;
+
+	clear_doorbell(pq);
+	t = __sync_lock_test_and_set(&pq->head,NULL);
+	fifo = NULL;
+	while(t){
+		posttask *n = t->next;
+
+		t->next = fifo;
+		fifo = t;
+		t = n;
+	}
+	++evh->stats.postdrains;
+	while( (t = fifo) ){
+		fifo = t->next;
+		++evh->stats.posts;
+		t->fxn(t->arg);
+		free(t);
+	}
+}
+
+// Guess an empty stack; a failed exchange returns the actual head.
+torque_err post_task(postq *pq,libtorquepostcb fxn,void *arg){
+	posttask *t,*head,*seen;
+
+	if((t = malloc(sizeof(*t))) == NULL){
+		return TORQUE_ERR_RESOURCE;
+	}
+	t->fxn = fxn;
+	t->arg = arg;
+	head = NULL;
+	for(;;){
+		t->next = head;
+		if((seen = __sync_val_compare_and_swap(&pq->head,head,t)) == head){
+			break;
+		}
+		head = seen;
+	}
+	// The task is queued regardless; should we fail to ring, it runs with
+	// the next task to get through.
+	if(head == NULL && ring_doorbell(pq)){
+		return TORQUE_ERR_ASSERT;
+	}
+	return 0;
+}
+
+postq *create_postq(torque_ctx *ctx,const evqueue *evq){
+	postq *pq;
+
+	if((pq = malloc(sizeof(*pq))) == NULL){
+		return NULL;
+	}
+	memset(pq,0,sizeof(*pq));
+#ifdef TORQUE_LINUX_EVENTFD
+	if((pq->fd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC)) < 0){
+		free(pq);
+		return NULL;
+	}
+#else
+	{
+		int fds[2];
+
+		if(pipe(fds)){
+			free(pq);
+			return NULL;
+		}
+		pq->fd = fds[0];
+		pq->wfd = fds[1];
+		if(fcntl(pq->fd,F_SETFL,O_NONBLOCK) || fcntl(pq->wfd,F_SETFL,O_NONBLOCK)
+				|| fcntl(pq->fd,F_SETFD,FD_CLOEXEC)
+				|| fcntl(pq->wfd,F_SETFD,FD_CLOEXEC)){
+			close(pq->wfd);
+			close(pq->fd);
+			free(pq);
+			return NULL;
+		}
+	}
+#endif
+	if(add_fd_to_evhandler(ctx,evq,pq->fd,postq_rxfxn,NULL,pq,0)){
+		destroy_postq(pq);
+		return NULL;
+	}
+	return pq;
+}
+
+int destroy_postq(postq *pq){
+	int ret = 0;
+
+	if(pq){
+		posttask *t;
+
+		while( (t = pq->head) ){
+			pq->head = t->next;
+			free(t);
+		}
+#ifndef TORQUE_LINUX_EVENTFD
+		ret |= close(pq->wfd);
+#endif
+		ret |= close(pq->fd);
+		free(pq);
+	}
+	return ret;
+}
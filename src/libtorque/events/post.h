@@ -0,0 +1,47 @@
+#ifndef LIBTORQUE_EVENTS_POST
+#define LIBTORQUE_EVENTS_POST
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libtorque/internal.h>
+
+// Tasks posted to an evqueue from any thread (see torque_post()). Producers
+// push onto a lock-free stack, and the push which finds the stack empty rings
+// the evqueue's doorbell (an eventfd on Linux, a pipe elsewhere). Whichever
+// event thread answers the doorbell takes the entire stack with a single
+// exchange, and runs the batch in the order posted. Batches being taken
+// whole, any number of threads can drain the stack at once, and there's no
+// ABA hazard: nodes are never popped individually.
+typedef struct posttask {
+	struct posttask *next;
+	libtorquepostcb fxn;
+	void *arg;
+} posttask;
+
+typedef struct postq {
+	posttask *head;			// most recently posted first
+	int fd;				// doorbell, registered with the evqueue
+#ifndef TORQUE_LINUX_EVENTFD
+	int wfd;			// write end of the doorbell pipe
+#endif
+} postq;
+
+postq *create_postq(struct torque_ctx *,const struct evqueue *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2)))
+	__attribute__ ((malloc));
+
+// Pending tasks are discarded without being run.
+int destroy_postq(postq *);
+
+torque_err post_task(postq *,libtorquepostcb,void *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2)));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,6 +7,18 @@
 #include <libtorque/events/signal.h>
 #include <libtorque/events/sources.h>
 
+static __thread const torque_siginfo *tsd_siginfo;
+
+const torque_siginfo *torque_getsiginfo(void){
+	return tsd_siginfo;
+}
+
+void handle_siginfo(const torque_ctx *ctx,const torque_siginfo *si){
+	tsd_siginfo = si;
+	handle_evsource_read(ctx->eventtables.sigarray,si->signo);
+	tsd_siginfo = NULL;
+}
+
 void signal_demultiplexer(int s){
 	torque_ctx *ctx = get_thread_ctx();
 	int errdup;
@@ -72,21 +84,22 @@ torque_err add_signal_to_evhandler(torque_ctx *ctx,const evqueue *evq __attribut
 	}
 #ifdef TORQUE_LINUX_SIGNALFD
 	{
-		// FIXME we could restrict this all to a single signalfd, since
-		// it takes a sigset_t...less potential parallelism, though
-		torque_err ret;
-		int fd;
+		// The common signalfd is already registered with every evqueue;
+		// we need only extend its mask.
+		evtables *evt = &ctx->eventtables;
+		sigset_t s;
 
-		if((fd = signalfd(-1,sigs,SFD_NONBLOCK | SFD_CLOEXEC)) < 0){
-			if(errno == ENOSYS){
-				return TORQUE_ERR_UNAVAIL;
-			}
-			return TORQUE_ERR_RESOURCE;
+		pthread_mutex_lock(&evt->siglock);
+		if(sigorset(&s,&evt->common_sigset,sigs)){
+			pthread_mutex_unlock(&evt->siglock);
+			return TORQUE_ERR_INVAL;
 		}
-		if( (ret = add_fd_to_evhandler(ctx,evq,fd,signalfd_demultiplexer,NULL,ctx,0)) ){
-			close(fd);
-			return ret;
+		if(signalfd(evt->common_signalfd,&s,0) < 0){
+			pthread_mutex_unlock(&evt->siglock);
+			return TORQUE_ERR_RESOURCE;
 		}
+		evt->common_sigset = s;
+		pthread_mutex_unlock(&evt->siglock);
 	}
 #elif defined(TORQUE_LINUX)
 	if(add_epoll_sigset(sigs,ctx->eventtables.sigarraysize)){
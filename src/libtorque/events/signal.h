@@ -20,6 +20,11 @@ int init_signal_handlers(void)
 
 void signal_demultiplexer(int);
 
+// Invoke the signal's callback, with the siginfo available through
+// torque_getsiginfo().
+void handle_siginfo(const struct torque_ctx *,const torque_siginfo *)
+	__attribute__ ((nonnull (1,2)));
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,6 +18,10 @@ typedef struct evsource {
 	libtorquercb rxfxn;	// read-type event callback function
 	libtorquewcb txfxn;	// write-type event callback function
 	void *cbstate;		// client per-source callback state
+	int armed;		// registered interest, if on a private evqueue
+	torque_prio prio;	// priority class (lane)
+	unsigned gen;		// setups of the fd, validating deferred events
+	unsigned deferred;	// lane slot (+1) of its deferred event, if any
 } evsource;
 
 struct evectors;
@@ -72,6 +76,10 @@ setup_evsource(evsource *evs,int n,libtorquercb rfxn,libtorquewcb tfxn,void *v){
 	set_evsource_rx(evs,n,rfxn);
 	set_evsource_tx(evs,n,tfxn);
 	evs[n].cbstate = v;
+	evs[n].armed = 0;
+	evs[n].prio = TORQUE_PRIO_NORMAL;
+	++evs[n].gen;
+	evs[n].deferred = 0;
 }
 
 static inline void handle_evsource_read(evsource *,int)
@@ -1,31 +1,62 @@
 #include <string.h>
 #include <unistd.h>
 #include <libtorque/events/evq.h>
+#include <libtorque/events/uring.h>
 #include <libtorque/events/sysdep.h>
 #include <libtorque/events/thread.h>
 #include <libtorque/events/signal.h>
 #include <libtorque/events/sources.h>
 
 #ifdef TORQUE_LINUX_SIGNALFD
+#define SIGINFO_BATCH 16
+
+// The signalfd is level-triggered, so a short read (the queue having been
+// drained) ends our work without a further read to find EAGAIN. Records are
+// only ever returned whole. The thread exits upon handling EVTHREAD_TERM or
+// EVTHREAD_INT, so these are held until the rest of the batch is handled.
 void signalfd_demultiplexer(int fd,void *cbstate){
+	struct signalfd_siginfo si[SIGINFO_BATCH];
 	const torque_ctx *ctx = cbstate;
+	evhandler *e = get_thread_evh();
+	torque_siginfo term;
 	ssize_t r;
 
+	term.signo = 0;
 	do{
-		struct signalfd_siginfo si;
+		unsigned z,n;
 
-		if((r = read(fd,&si,sizeof(si))) == sizeof(si)){
-			evhandler *e = get_thread_evh();
-			int sig = si.ssi_signo;
+		++e->stats.sigreads;
+		if((r = read(fd,si,sizeof(si))) < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			if(errno != EAGAIN && errno != EWOULDBLOCK){
+				++e->stats.errors;
+			}
+			break;
+		}
+		n = r / sizeof(*si);
+		for(z = 0 ; z < n ; ++z){
+			torque_siginfo tsi;
 
+			tsi.signo = si[z].ssi_signo;
+			tsi.code = si[z].ssi_code;
+			tsi.pid = si[z].ssi_pid;
+			tsi.uid = si[z].ssi_uid;
+			// sigqueue(3) payloads arrive as both members; ssi_ptr
+			// carries the full width of the union.
+			tsi.value.sival_ptr = (void *)(uintptr_t)si[z].ssi_ptr;
 			++e->stats.events;
-			handle_evsource_read(ctx->eventtables.sigarray,sig);
-		}else if(r >= 0){
-			// FIXME stat short read!
+			++e->stats.signals;
+			if(tsi.signo == EVTHREAD_TERM || tsi.signo == EVTHREAD_INT){
+				term = tsi;
+				continue;
+			}
+			handle_siginfo(ctx,&tsi);
 		}
-	}while(r >= 0 || errno == EINTR);
-	if(errno != EAGAIN && errno != EWOULDBLOCK){
-		// FIXME stat on error reading signalfd!
+	}while(r == sizeof(si) && term.signo == 0);
+	if(term.signo){
+		handle_siginfo(ctx,&term);
 	}
 }
 #elif defined(TORQUE_LINUX)
@@ -74,12 +105,35 @@ int add_epoll_sigset(const sigset_t *s,unsigned maxsignal){
 }
 #endif
 
-int restorefd(const struct evhandler *evh,int fd,int eflags){
+// Sources on a private evqueue are registered without EVONESHOT, and remain
+// armed across events. They need only be modified if the interest changes.
+// Under io_uring, the new poll request is queued, and submitted as part of the
+// thread's next wait.
+int restorefd(struct evhandler *evh,int fd,int eflags){
+	const torque_ctx *ctx = get_thread_ctx();
+	int oneshot = EVONESHOT;
 	EVECTOR_AUTOS(1,ev);
 
+	if(ctx->opts.evqmode == TORQUE_EVQ_THREAD &&
+			ctx->opts.evbackend != TORQUE_BACKEND_URING){
+		evsource *evs = &ctx->eventtables.fdarray[fd];
+
+		if(evs->armed == eflags){
+			++evh->stats.rearmsaved;
+			return 0;
+		}
+		evs->armed = eflags;
+		oneshot = 0;
+	}
+	++evh->stats.rearms;
+#ifdef TORQUE_LINUX_URING
+	if(evh->evq->ring){
+		return uring_add(evh->evq,fd,EVEDGET | oneshot | eflags);
+	}
+#endif
 #ifdef TORQUE_LINUX
 	memset(&ev.eventv.events[0],0,sizeof(ev.eventv.events[0]));
-	ev.eventv.events[0].events = EVEDGET | EVONESHOT | eflags;
+	ev.eventv.events[0].events = EVEDGET | oneshot | eflags;
 	ev.eventv.events[0].data.fd = fd;
 	ev.eventv.ctldata[0].op = EPOLL_CTL_MOD;
 #elif defined(TORQUE_FREEBSD)
@@ -91,7 +145,7 @@ int restorefd(const struct evhandler *evh,int fd,int eflags){
 			return -1;
 		}
 		filter = eflags & EVREAD ? EVREAD : EVWRITE;
-		EV_SET(&ev.eventv[0],fd,filter,EV_ADD | EVEDGET | EVONESHOT | eflags,0,0,NULL);
+		EV_SET(&ev.eventv[0],fd,filter,EV_ADD | EVEDGET | oneshot | eflags,0,0,NULL);
 	}
 #endif
 	if(Kevent(evh->evq->efd,PTR_TO_EVENTV(&ev),1,NULL,0)){
@@ -29,6 +29,21 @@ extern "C" {
 #define EVWRITE EPOLLOUT
 #define EVONESHOT EPOLLONESHOT
 #define EVEDGET EPOLLET
+#ifdef EPOLLEXCLUSIVE
+#define EVEXCLUSIVE EPOLLEXCLUSIVE
+#else
+#define EVEXCLUSIVE 0
+#endif
+
+// MSG_ZEROCOPY (Linux 4.14+, glibc 2.27+); kernel support is determined when
+// it's enabled (see torque_txzerocopy()). Completions are queued on the
+// socket's error queue, signaled by EPOLLERR alone, for which interest can
+// be registered (without read or write interest) as EVERROR.
+#include <sys/socket.h>
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define TORQUE_LINUX_ZEROCOPY
+#define EVERROR EPOLLERR
+#endif
 
 #define PTR_TO_EVENTV(ev) (&(ev)->eventv)
 typedef struct epoll_event kevententry;
@@ -56,6 +71,17 @@ struct kevent { // each element an array, each array the same number of members
 #include <sys/timerfd.h>
 #define TORQUE_LINUX_SIGNALFD
 #include <sys/signalfd.h>
+#define TORQUE_LINUX_EVENTFD
+#include <sys/eventfd.h>
+// io_uring was introduced in Linux 5.1, but we require facilities from 5.5
+// (see events/uring.c). We merely require the headers here, and determine
+// kernel support at runtime.
+#ifndef LIBTORQUE_WITHOUT_URING
+#include <sys/syscall.h>
+#ifdef __NR_io_uring_setup
+#define TORQUE_LINUX_URING
+#endif
+#endif
 struct torque_cbctx;
 
 void signalfd_demultiplexer(int,void *);
@@ -129,6 +155,14 @@ Kevent(int epfd,struct kevent *changelist,int nchanges,
 	return ret;
 }
 
+// Retrieve any ready events without blocking, as used for spinning (see
+// event_thread()). Signals are handled by the blocking retrieval which follows
+// an unsuccessful spin, so we needn't unmask them here.
+static inline int
+Kevent_nowait(int epfd,struct kevent *eventlist,int nevents){
+	return epoll_wait(epfd,eventlist->events,nevents,0);
+}
+
 #elif defined(TORQUE_FREEBSD)
 #include <stdint.h>
 #include <sys/types.h>
@@ -138,6 +172,7 @@ Kevent(int epfd,struct kevent *changelist,int nchanges,
 #define EVWRITE EVFILT_WRITE
 #define EVONESHOT EV_ONESHOT
 #define EVEDGET EV_CLEAR
+#define EVEXCLUSIVE 0
 
 #define PTR_TO_EVENTV(ev) ((ev)->eventv)
 typedef struct kevent kevententry;
@@ -160,6 +195,13 @@ Kevent(int kq,struct kevent *changelist,int nchanges,
 	}
 	return ret;
 }
+
+static inline int
+Kevent_nowait(int kq,struct kevent *eventlist,int nevents){
+	const struct timespec zero = { .tv_sec = 0, .tv_nsec = 0, };
+
+	return kevent(kq,NULL,0,eventlist,nevents,&zero);
+}
 #endif
 
 // State necessary for changing the domain of events and/or having them
@@ -180,7 +222,7 @@ typedef struct evectors {
 
 struct evhandler;
 
-int restorefd(const struct evhandler *,int fd,int eflags)
+int restorefd(struct evhandler *,int fd,int eflags)
 	__attribute__ ((warn_unused_result))
 	__attribute__ ((nonnull(1)));
 
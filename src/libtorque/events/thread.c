@@ -1,11 +1,18 @@
+#include <time.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
 #include <string.h>
 #include <pthread.h>
 #include <sys/resource.h>
+#ifdef TORQUE_LINUX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include <libtorque/buffers.h>
 #include <libtorque/events/fd.h>
 #include <libtorque/events/evq.h>
+#include <libtorque/events/uring.h>
 #include <libtorque/events/timer.h>
 #include <libtorque/events/sysdep.h>
 #include <libtorque/events/thread.h>
@@ -15,6 +22,9 @@
 
 static __thread torque_ctx *tsd_ctx;
 static __thread evhandler *tsd_evhandler;
+static __thread uint64_t tsd_now;		// see torque_now()
+static __thread uint64_t tsd_wallround;	// tsd_now as of tsd_wall
+static __thread struct timeval tsd_wall;
 
 evhandler *get_thread_evh(void){
 	return tsd_evhandler;
@@ -24,9 +34,42 @@ torque_ctx *get_thread_ctx(void){
 	return tsd_ctx;
 }
 
+uint64_t torque_now(void){
+	return tsd_now ? tsd_now : monotonic_ns();
+}
+
+int round_timeval(struct timeval *tv){
+	if(tsd_now == 0 || tsd_wallround != tsd_now){
+		if(gettimeofday(&tsd_wall,NULL)){
+			return -1;
+		}
+		tsd_wallround = tsd_now;
+	}
+	*tv = tsd_wall;
+	return 0;
+}
+
 static inline void
 handle_event(torque_ctx *ctx,const kevententry *e){
+#ifdef TORQUE_LINUX_URING
+	if(e->events & URING_EVCQE){
+		uring_handle_cqe(ctx,&get_thread_evh()->cqev[e->data.u32]);
+		return;
+	}
+#endif
 #ifdef TORQUE_LINUX
+	// An error or hangup alone (ie, zerocopy completions on a socket's
+	// error queue, or a timed-out connection's shutdown) goes to the write
+	// handler, or the read handler should there be none. Dropping it would
+	// leave a one-shot source disarmed.
+	if(!(e->events & (EVREAD | EVWRITE)) && (e->events & (EPOLLERR | EPOLLHUP))){
+		if(ctx->eventtables.fdarray[KEVENTENTRY_ID(e)].txfxn){
+			handle_evsource_write(ctx->eventtables.fdarray,KEVENTENTRY_ID(e));
+		}else{
+			handle_evsource_read(ctx->eventtables.fdarray,KEVENTENTRY_ID(e));
+		}
+		return;
+	}
 	if(e->events & EVREAD){
 #else
 	if(e->filter == EVFILT_READ){
@@ -44,11 +87,123 @@ handle_event(torque_ctx *ctx,const kevententry *e){
 	else if(e->filter == EVFILT_SIGNAL){
 		handle_evsource_read(ctx->eventtables.sigarray,KEVENTENTRY_ID(e));
         }else if(e->filter == EVFILT_TIMER){
-		timer_curry(KEVENTENTRY_IDPTR(e));
+		twheel_expire(KEVENTENTRY_IDPTR(e));
 	}
 #endif
 }
 
+// Leader/follower waiting (see torque_opts). Only the leader waits in the
+// kernel; upon retrieving events, it promotes the most recently parked
+// follower (whose cache is likely the warmest) before dispatching them.
+// Followers park on a futex in their evhandler, which the promoter sets.
+#ifdef TORQUE_LINUX
+static inline void
+futex_wait(int *uaddr,int val){
+	syscall(SYS_futex,uaddr,FUTEX_WAIT_PRIVATE,val,NULL,NULL,0);
+}
+
+static inline void
+futex_wake(int *uaddr){
+	syscall(SYS_futex,uaddr,FUTEX_WAKE_PRIVATE,1,NULL,NULL,0);
+}
+#else
+#define futex_wait(...)
+#define futex_wake(...)
+#endif
+
+evleader *create_evleader(void){
+	evleader *ret;
+
+	if( (ret = malloc(sizeof(*ret))) ){
+		if(pthread_mutex_init(&ret->lock,NULL) == 0){
+			ret->leader = ret->followers = NULL;
+			ret->closed = 0;
+			return ret;
+		}
+		free(ret);
+	}
+	return NULL;
+}
+
+int destroy_evleader(evleader *lf){
+	int ret = 0;
+
+	ret |= pthread_mutex_destroy(&lf->lock);
+	free(lf);
+	return ret;
+}
+
+// Returns once we're the leader, or leadership has been abandoned. Should the
+// lock fail, we simply wait in the kernel alongside the leader.
+static void
+lf_follow(evhandler *e,evleader *lf){
+	if(pthread_mutex_lock(&lf->lock)){
+		return;
+	}
+	if(lf->closed || lf->leader == NULL){
+		if(!lf->closed){
+			lf->leader = e;
+		}
+		pthread_mutex_unlock(&lf->lock);
+		return;
+	}
+	e->lfwake = 0;
+	e->lfnext = lf->followers;
+	lf->followers = e;
+	pthread_mutex_unlock(&lf->lock);
+	while(*(volatile int *)&e->lfwake == 0){
+		futex_wait(&e->lfwake,0);
+	}
+}
+
+static inline void
+lf_wake(evhandler *f){
+	__sync_synchronize();
+	*(volatile int *)&f->lfwake = 1;
+	futex_wake(&f->lfwake);
+}
+
+static void
+lf_handoff(evhandler *e,evleader *lf){
+	evhandler *f;
+
+	if(pthread_mutex_lock(&lf->lock)){
+		return;
+	}
+	if(lf->leader == e){
+		if( (f = lf->followers) ){
+			lf->followers = f->lfnext;
+			++e->stats.lfhandoffs;
+			lf_wake(f);
+		}
+		lf->leader = f;
+	}
+	pthread_mutex_unlock(&lf->lock);
+}
+
+// Terminating threads are signalled in turn, and must be waiting in the kernel
+// to receive the signal. Release all followers, and cease parking.
+static void
+lf_close(const torque_ctx *ctx){
+	const evqueue *evq;
+
+	for(evq = &ctx->evq ; evq ; evq = evq->next){
+		evleader *lf = evq->lf;
+		evhandler *f;
+
+		if(lf == NULL || pthread_mutex_lock(&lf->lock)){
+			continue;
+		}
+		lf->closed = 1;
+		lf->leader = NULL;
+		while( (f = lf->followers) ){
+			lf->followers = f->lfnext;
+			lf_wake(f);
+		}
+		pthread_mutex_unlock(&lf->lock);
+	}
+}
+
 void rxcommonsignal(int sig,void *cbstate){
 	if(sig == EVTHREAD_TERM || sig == EVTHREAD_INT){
 		const torque_ctx *ctx = cbstate;
@@ -57,6 +212,7 @@ void rxcommonsignal(int sig,void *cbstate){
 		struct rusage ru;
 		int r;
 
+		lf_close(ctx);
 		// There's no POSIX thread cancellation going on here, nor are
 		// we terminating due to signal; we're catching the signal and
 		// exiting from this thread only. The trigger signal might be
@@ -107,29 +263,332 @@ rxcommonsignal_handler(int sig,void *cbstate __attribute__ ((unused))){
 #define check_for_termination(...)
 #endif
 
+// Ask for twice the recent average (so that a burst is seen as such), and
+// double immediately should a round fill the vector. Threads sharing an
+// evqueue are limited to their share of the maximum, so that one thread
+// doesn't walk off with a burst while the others idle.
+static inline void
+adapt_evectors(evhandler *e,int n){
+	unsigned threads = e->evq->threads;
+	int want,cap;
+
+	e->evecavg = e->evecavg - (e->evecavg >> 4) + n;
+	if(n >= e->evec.vsizes){
+		want = e->evec.vsizes * 2;
+	}else{
+		want = (e->evecavg >> 4) * 2;
+	}
+	cap = threads > 1 ? e->evecmax / (int)threads : e->evecmax;
+	if(want > cap){
+		want = cap;
+	}
+	if(want < e->evecmin){
+		want = e->evecmin;
+	}
+	if(want != e->evec.vsizes){
+		e->evec.vsizes = want;
+		e->stats.evecsize = want;
+	}
+}
+
+static inline int
+retrieve_events(evhandler *e,int block){
+#ifdef TORQUE_LINUX_URING
+	if(e->evq->ring){
+		return uring_retrieve(e,block);
+	}
+#endif
+	if(block){
+		int ret;
+
+		ret = Kevent(e->evq->efd,NULL,0,PTR_TO_EVENTV(&e->evec),e->evec.vsizes);
+		if(ret == 0 || (ret < 0 && errno == EINTR)){ // woken for nothing
+			++e->stats.spuriouswakes;
+		}
+		return ret;
+	}
+	return Kevent_nowait(e->evq->efd,PTR_TO_EVENTV(&e->evec),e->evec.vsizes);
+}
+
+// Poll without blocking until events arrive or the spin window expires, and
+// then block. The clock is only read every few polls.
+static inline int
+spin_events(evhandler *e,unsigned spinus){
+	uint64_t deadline = monotonic_ns() + spinus * 1000ull;
+	int events;
+
+	do{
+		unsigned z;
+
+		for(z = 0 ; z < 8 ; ++z){
+			if((events = retrieve_events(e,0)) != 0){
+				if(events > 0){
+					++e->stats.spinhits;
+				}
+				return events;
+			}
+		}
+	}while(monotonic_ns() < deadline);
+	++e->stats.spinmisses;
+	return retrieve_events(e,1);
+}
+
+static inline kevententry *
+evhandler_event(evhandler *e,int n){
+#ifdef TORQUE_LINUX
+	return &PTR_TO_EVENTV(&e->evec)->events[n];
+#else
+	return &PTR_TO_EVENTV(&e->evec)[n];
+#endif
+}
+
+// Each lane's ring holds twice the largest event vector. No lane is left with
+// more than half that at the end of a round, whatever its budget, so a round's
+// events always fit.
+static int
+init_lanes(evhandler *e){
+	evlaned *q;
+	unsigned l;
+
+	e->lanecap = e->evecmax * 2;
+	if((q = malloc(sizeof(*q) * e->lanecap * TORQUE_PRIO_CLASSES)) == NULL){
+		return -1;
+	}
+	for(l = 0 ; l < TORQUE_PRIO_CLASSES ; ++l){
+		e->lanes[l].q = q + l * e->lanecap;
+		e->lanes[l].head = e->lanes[l].count = 0;
+	}
+	return 0;
+}
+
+// The source of a readiness event, or NULL for FreeBSD's signals and timers.
+static inline evsource *
+event_source(const torque_ctx *ctx,const kevententry *k){
+#ifdef TORQUE_LINUX
+	return &ctx->eventtables.fdarray[KEVENTENTRY_ID(k)];
+#else
+	if(k->filter == EVFILT_READ || k->filter == EVFILT_WRITE){
+		return &ctx->eventtables.fdarray[KEVENTENTRY_ID(k)];
+	}
+	return NULL;
+#endif
+}
+
+// Completions of io_uring requests (rather than readiness events) refer to
+// the evhandler's cqev, overwritten by the next retrieval, and are thus never
+// deferred. They're dispatched at TORQUE_PRIO_NORMAL.
+static inline unsigned
+event_lane(const torque_ctx *ctx,const kevententry *k){
+	const evsource *evs;
+
+#ifdef TORQUE_LINUX_URING
+	if(k->events & URING_EVCQE){
+		return TORQUE_PRIO_CLASSES;
+	}
+#endif
+	if( (evs = event_source(ctx,k)) ){
+		return evs->prio;
+	}
+	return TORQUE_PRIO_NORMAL;
+}
+
+// A source on a private evqueue isn't one-shot, and can be reported again
+// while its earlier event sits in a lane. Rather than being dispatched twice
+// (the first dispatch perhaps closing it), the new event is merged into the
+// deferred one. Returns non-zero if it was. Only the owning thread sees a
+// private evqueue's sources, so evs->deferred needn't be synchronized; on
+// shared evqueues, sources are one-shot (excepting concurrent listeners,
+// which tolerate duplicates), and it remains unused.
+static inline int
+lane_merge(const torque_ctx *ctx,evlane *lane,evsource *evs,const kevententry *k){
+	kevententry *d;
+
+	if(ctx->opts.evqmode != TORQUE_EVQ_THREAD || !evs->deferred){
+		return 0;
+	}
+	d = &lane->q[evs->deferred - 1].ev;
+#ifdef TORQUE_LINUX
+	d->events |= k->events;
+	return 1;
+#else
+	return d->filter == k->filter;
+#endif
+}
+
+// A deferred event is stale if its fd has since been closed and set up anew
+// (possibly as a different file). Otherwise, it's no longer deferred.
+static inline int
+lane_current(const torque_ctx *ctx,const evlaned *d,unsigned slot){
+	evsource *evs;
+
+	if((evs = event_source(ctx,&d->ev)) == NULL){
+		return 1;
+	}
+	if(evs->gen != d->gen){
+		return 0;
+	}
+	if(evs->deferred == slot + 1){
+		evs->deferred = 0;
+	}
+	return 1;
+}
+
+static inline void
+lane_account(evthreadstats *stats,unsigned l,unsigned n,uint64_t ns){
+	switch(l){
+	case TORQUE_PRIO_CONTROL:
+		stats->ctlevents += n;
+		stats->ctllatns += ns;
+		break;
+	case TORQUE_PRIO_NORMAL:
+		stats->normevents += n;
+		stats->normlatns += ns;
+		break;
+	default:
+		stats->bulkevents += n;
+		stats->bulklatns += ns;
+		break;
+	}
+}
+
+static void
+drain_lane(torque_ctx *ctx,evhandler *e,unsigned l){
+	evlane *lane = &e->lanes[l];
+	uint64_t now,lat = 0;
+	unsigned n,z;
+
+	n = lane->count;
+	if(n > ctx->opts.lanebudget[l]){
+		n = ctx->opts.lanebudget[l];
+	}
+	if(lane->count - n > e->lanecap / 2){
+		n = lane->count - e->lanecap / 2;
+	}
+	if(n){
+		now = monotonic_ns();
+		for(z = 0 ; z < n ; ++z){
+			evlaned *d = &lane->q[lane->head];
+			unsigned slot = lane->head;
+
+			lane->head = (lane->head + 1) % e->lanecap;
+			--lane->count;
+			--e->backlog;
+			lat += now - d->when;
+			if(!lane_current(ctx,d,slot)){
+				++e->stats.lanestale;
+				continue;
+			}
+			handle_event(ctx,&d->ev);
+			++e->stats.events;
+		}
+		lane_account(&e->stats,l,n,lat);
+	}
+	e->stats.lanedeferrals += lane->count;
+}
+
+static void
+dispatch_lanes(torque_ctx *ctx,evhandler *e,int events){
+	uint64_t now = monotonic_ns();
+	unsigned l;
+	int n;
+
+	for(n = 0 ; n < events ; ++n){
+		const kevententry *k = evhandler_event(e,n);
+		evsource *evs;
+		evlane *lane;
+		unsigned slot;
+
+		if((l = event_lane(ctx,k)) >= TORQUE_PRIO_CLASSES){
+			continue;
+		}
+		lane = &e->lanes[l];
+		if( (evs = event_source(ctx,k)) && lane_merge(ctx,lane,evs,k)){
+			++e->stats.lanemerged;
+			continue;
+		}
+		slot = (lane->head + lane->count) % e->lanecap;
+		lane->q[slot].ev = *k;
+		lane->q[slot].when = now;
+		lane->q[slot].gen = evs ? evs->gen : 0;
+		if(evs && ctx->opts.evqmode == TORQUE_EVQ_THREAD){
+			evs->deferred = slot + 1;
+		}
+		++lane->count;
+		++e->backlog;
+	}
+	for(l = 0 ; l < TORQUE_PRIO_CLASSES ; ++l){
+		if(l == TORQUE_PRIO_NORMAL){
+			for(n = 0 ; n < events ; ++n){
+				if(event_lane(ctx,evhandler_event(e,n)) >= TORQUE_PRIO_CLASSES){
+					handle_event(ctx,evhandler_event(e,n));
+					++e->stats.events;
+				}
+			}
+		}
+		drain_lane(ctx,e,l);
+	}
+}
+
 void event_thread(torque_ctx *ctx,evhandler *e){
 	tsd_evhandler = e;
 	tsd_ctx = ctx;
 	while(1){
-		int events;
+		evleader *lf = e->evq->threads > 1 ? e->evq->lf : NULL;
+		uintmax_t dispatched;
+		int events,lanes;
 
 		check_for_termination();
-		events = Kevent(e->evq->efd,NULL,0,PTR_TO_EVENTV(&e->evec),e->evec.vsizes);
+		lanes = ctx->prioritized && (e->lanes[0].q || init_lanes(e) == 0);
+		// With events deferred in the lanes, we mustn't block (nor
+		// wait behind a leader), but still pick up newly-ready events.
+		if(e->backlog){
+			events = retrieve_events(e,0);
+		}else{
+			if(lf){
+				lf_follow(e,lf);
+			}
+			if(ctx->opts.spinus){
+				events = spin_events(e,ctx->opts.spinus);
+			}else{
+				events = retrieve_events(e,1);
+			}
+			if(lf){
+				lf_handoff(e,lf);
+			}
+			if(events >= 0){
+				adapt_evectors(e,events);
+			}
+		}
 		++e->stats.rounds;
+		tsd_now = clock_ns(ctx->opts.coarseclock ? TORQUE_CLOCK_COARSE
+							: CLOCK_MONOTONIC);
 		if(events < 0){
 			if(errno != EINTR){
 				++e->stats.pollerr;
 			}
-			continue;
+			if(e->backlog == 0){
+				continue;
+			}
+			events = 0;
 		}
-		while(events--){
-#ifdef TORQUE_LINUX
-			handle_event(ctx,&PTR_TO_EVENTV(&e->evec)->events[events]);
-#else
-			handle_event(ctx,&PTR_TO_EVENTV(&e->evec)[events]);
-#endif
+		dispatched = e->stats.events;
+		if(lanes){
+			dispatch_lanes(ctx,e,events);
+		}else while(events--){
+			handle_event(ctx,evhandler_event(e,events));
 			++e->stats.events;
 		}
+		// Every event of the round having found nothing to do (ie, the
+		// listener's connection was accepted by another thread), the
+		// wakeup was wasted.
+		if((dispatched = e->stats.events - dispatched) &&
+				e->fruitless >= dispatched){
+			++e->stats.spuriouswakes;
+		}
+		e->fruitless = 0;
+		if(e->reclaim){
+			reclaim_rxbuffercbs(e);
+		}
 	}
 }
 
@@ -165,15 +624,32 @@ destroy_evector(struct kevent **kv){
 }
 
 static int
-init_evectors(evectors *ev){
-	// We probably want about a half (small) page's worth...? FIXME
-	ev->vsizes = 512;
+init_evectors(evectors *ev,int n){
+	ev->vsizes = n;
 	if(create_evector(&ev->eventv,ev->vsizes)){
 		return -1;
 	}
 	return 0;
 }
 
+// The event vector is allocated at its largest size, that being the
+// configured maximum, further limited to half the L1 data cache (leaving the
+// remainder to the callbacks processing the events). Rounds start at the
+// minimum, and adapt from there (see adapt_evectors()).
+static void
+size_evectors(const torque_ctx *ctx,evhandler *e,const evqueue *evq){
+	e->evecmin = ctx->opts.evecmin;
+	e->evecmax = ctx->opts.evecmax;
+	if(evq->l1dsize && evq->l1dsize / 2 / sizeof(kevententry) < (unsigned)e->evecmax){
+		e->evecmax = evq->l1dsize / 2 / sizeof(kevententry);
+	}
+	if(e->evecmax < e->evecmin){
+		e->evecmax = e->evecmin;
+	}
+	e->evecavg = e->evecmin * 16;
+	e->stats.evecsize = e->evecmin;
+}
+
 static void
 destroy_evectors(evectors *e){
 	if(e){
@@ -204,7 +680,13 @@ int initialize_common_sources(torque_ctx *ctx,struct evtables *evt,const sigset_
 	if((evt->common_signalfd = signalfd(-1,&s,SFD_NONBLOCK | SFD_CLOEXEC)) < 0){
 		return -1;
 	}
+	if(pthread_mutex_init(&evt->siglock,NULL)){
+		close(evt->common_signalfd);
+		return -1;
+	}
+	evt->common_sigset = s;
 	setup_evsource(evt->fdarray,evt->common_signalfd,signalfd_demultiplexer,NULL,ctx);
+	evt->fdarray[evt->common_signalfd].prio = TORQUE_PRIO_CONTROL;
 	setup_evsource(evt->sigarray,EVTHREAD_TERM,rxcommonsignal,NULL,ctx);
 	setup_evsource(evt->sigarray,EVTHREAD_INT,rxcommonsignal,NULL,ctx);
 	}
@@ -225,14 +707,25 @@ int initialize_common_sources(torque_ctx *ctx,struct evtables *evt,const sigset_
 }
 
 static int
-initialize_evhandler(evhandler *e,const evqueue *evq,const stack_t *stack){
+initialize_evhandler(const torque_ctx *ctx,evhandler *e,const evqueue *evq,
+					const stack_t *stack){
 	memset(e,0,sizeof(*e));
 	e->stats.stackptr = stack->ss_sp;
 	e->stats.stacksize = stack->ss_size;
 	e->evq = evq;
-	if(init_evectors(&e->evec)){
+	size_evectors(ctx,e,evq);
+	if(init_evectors(&e->evec,e->evecmax)){
 		return -1;
 	}
+	e->evec.vsizes = e->evecmin;
+#ifdef TORQUE_LINUX_URING
+	if(evq->ring){
+		if((e->cqev = malloc(sizeof(*e->cqev) * e->evecmax)) == NULL){
+			destroy_evectors(&e->evec);
+			return -1;
+		}
+	}
+#endif
 	return 0;
 }
 
@@ -269,11 +762,12 @@ int create_efd(void){
 	return fd;
 }
 
-evhandler *create_evhandler(const evqueue *evq,const stack_t *stack){
+evhandler *create_evhandler(const torque_ctx *ctx,const evqueue *evq,
+				const stack_t *stack){
 	evhandler *ret;
 
 	if( (ret = malloc(sizeof(*ret))) ){
-		if(initialize_evhandler(ret,evq,stack) == 0){
+		if(initialize_evhandler(ctx,ret,evq,stack) == 0){
 			return ret;
 		}
 		free(ret);
@@ -327,6 +821,12 @@ void destroy_evhandler(const torque_ctx *ctx,evhandler *e){
 	if(e){
 		print_evstats(ctx,&e->stats);
 		destroy_evectors(&e->evec);
+		free_rxscratch(e);
+		reclaim_rxbuffercbs(e);
+#ifdef TORQUE_LINUX_URING
+		free(e->cqev);
+#endif
+		free(e->lanes[0].q);
 		free(e);
 	}
 }
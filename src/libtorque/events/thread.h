@@ -6,21 +6,65 @@ extern "C" {
 #endif
 
 struct evectors;
+struct torque_rxbufcb;
+struct io_uring_cqe;
 
 #include <pthread.h>
+#include <sys/time.h>
 #include <libtorque/events/sysdep.h>
 #include <libtorque/events/sources.h>
 
+// Events awaiting dispatch in a priority lane, with the time of retrieval.
+typedef struct evlaned {
+	kevententry ev;
+	uint64_t when;			// monotonic nanoseconds
+	unsigned gen;			// the source's setup (see evsource)
+} evlaned;
+
+typedef struct evlane {
+	evlaned *q;			// ring of the evhandler's lanecap entries
+	unsigned head,count;
+} evlane;
+
 typedef struct evhandler {
 	const evqueue *evq;		// can be (likely is) shared
+	struct evhandler *lfnext;	// next parked follower
+	int lfwake;			// futex word upon which we park
 	pthread_t nexttid;
 	evectors evec;			// one for each thread
 	evthreadstats stats;		// one for each thread
+	int evecmin,evecmax;		// bounds on evec.vsizes (see thread.c)
+	unsigned evecavg;		// moving average of events per round (x16)
+	evlane lanes[TORQUE_PRIO_CLASSES]; // allocated upon first use
+	unsigned lanecap;		// entries in each lane's ring
+	unsigned backlog;		// events deferred among the lanes
+	unsigned fruitless;		// this round's events finding no work
+	char *rxscratch;		// buffered fds' reads (see buffers.h)
+	size_t rxscratchlen;
+	struct torque_rxbufcb *reclaim; // closed buffered fds (see buffers.c)
+#ifdef TORQUE_LINUX_URING
+	struct io_uring_cqe *cqev;	// non-poll completions (see uring.h)
+#endif
 } evhandler;
 
-evhandler *create_evhandler(const evqueue *,const stack_t *)
+// Leader/follower state of a shared evqueue (see thread.c).
+typedef struct evleader {
+	pthread_mutex_t lock;
+	evhandler *leader;		// thread waiting in the kernel, if any
+	evhandler *followers;		// parked threads, most recent first
+	int closed;			// terminating; nobody parks anymore
+} evleader;
+
+evleader *create_evleader(void)
 	__attribute__ ((warn_unused_result))
-	__attribute__ ((nonnull(1,2)))
+	__attribute__ ((malloc));
+
+int destroy_evleader(evleader *)
+	__attribute__ ((nonnull(1)));
+
+evhandler *create_evhandler(const torque_ctx *,const evqueue *,const stack_t *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2,3)))
 	__attribute__ ((malloc));
 
 int create_efd(void)
@@ -46,6 +90,11 @@ evhandler *get_thread_evh(void)
 torque_ctx *get_thread_ctx(void)
 	__attribute__ ((warn_unused_result));
 
+// Wall-clock time as of the calling event thread's current round, read at
+// most once per round (directly, outside of event threads).
+int round_timeval(struct timeval *)
+	__attribute__ ((nonnull(1)));
+
 void rxcommonsignal(int,void *);
 
 #ifdef __cplusplus
@@ -1,125 +1,466 @@
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
 #include <unistd.h>
 #include <libtorque/events/fd.h>
 #include <libtorque/events/timer.h>
 #include <libtorque/events/sysdep.h>
 #include <libtorque/events/thread.h>
-#include <libtorque/events/sources.h>
 
-static inline timerfd_marshal *
-create_timerfd_marshal(libtorquetimecb tfxn,void *cbstate){
-	timerfd_marshal *ret;
+// A timer expires with the first tick beginning at or after its deadline.
+static inline uint64_t
+deadline_tick(uint64_t deadline){
+	return (deadline + (1ull << TWHEEL_TICKSHIFT) - 1) >> TWHEEL_TICKSHIFT;
+}
+
+// The most aligned instant of the timer's window. Should the window wrap,
+// the deadline is used as is.
+static inline uint64_t
+timer_expiry(const torque_timer *t){
+	uint64_t limit = t->deadline + t->slack;
 
-	if( (ret = malloc(sizeof(*ret))) ){
-		ret->tfxn = tfxn;
-		ret->cbstate = cbstate;
+	if(limit > t->deadline){
+		unsigned bit = 63 - __builtin_clzll(limit ^ t->deadline);
+
+		limit &= ~((1ull << bit) - 1);
+		return limit;
 	}
-	return ret;
+	return t->deadline;
 }
 
 static inline void
-timer_passthru(int fd __attribute__ ((unused)),void *state){
-	timer_curry(state);
-}
-
-// from kevent(2) on FreeBSD 6.4:
-// EVFILT_SIGNAL  Takes the signal number to monitor as the identifier and
-// 	returns when the given signal is delivered to the process.
-// 	This coexists with the signal() and sigaction() facili-
-// 	ties, and has a lower precedence.  The filter will record
-// 	all attempts to deliver a signal to a process, even if the
-// 	signal has been marked as SIG_IGN.  Event notification
-// 	happens after normal signal delivery processing.  data
-// 	returns the number of times the signal has occurred since
-// 	the last call to kevent().  This filter automatically sets
-// 	the EV_CLEAR flag internally.
-// from signalfd(2) on Linux 2.6.31:
-//      The mask argument specifies the set of signals that the  caller  wishes
-//      to accept via the file descriptor.  This argument is a signal set whose
-//      contents can be initialized using the macros described in sigsetops(3).
-//      Normally,  the  set  of  signals to be received via the file descriptor
-//      should be blocked using sigprocmask(2), to prevent  the  signals  being
-//      handled according to their default dispositions.  It is not possible to
-//      receive SIGKILL or SIGSTOP signals  via  a  signalfd  file  descriptor;
-//      these signals are silently ignored if specified in mask.
-torque_err add_timer_to_evhandler(struct torque_ctx *ctx __attribute__ ((unused)),
-		const struct evqueue *evq __attribute__ ((unused)),
-		const struct itimerspec *t,libtorquetimecb tfxn,void *cbstate){
-	timerfd_marshal *tm;
+timer_push(torque_timer **head,torque_timer *t,unsigned level){
+	if( (t->next = *head) ){
+		t->next->pprev = &t->next;
+	}
+	t->pprev = head;
+	*head = t;
+	t->level = level;
+}
 
-	if((tm = create_timerfd_marshal(tfxn,cbstate)) == NULL){
-		return TORQUE_ERR_RESOURCE;
+static void
+twheel_link(twheel *w,torque_timer *t){
+	uint64_t tick = deadline_tick(timer_expiry(t)),delta;
+	unsigned level,slot;
+
+	if(tick < w->clk){
+		tick = w->clk;
 	}
-#ifdef TORQUE_LINUX_TIMERFD
-	{
-		int fd;
-
-		if((fd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK | TFD_CLOEXEC)) < 0){
-			free(tm);
-			if(errno == EINVAL){
-				return TORQUE_ERR_INVAL;
-			}else if(errno == ENODEV || errno == ENOSYS){
-				return TORQUE_ERR_UNAVAIL;
-			}
-			return TORQUE_ERR_RESOURCE;
+	delta = tick - w->clk;
+	if(delta >> (TWHEEL_BITS * TWHEEL_LEVELS)){
+		// Beyond our span; we'll reinsert it upon reaching the last slot.
+		tick = w->clk + (1ull << (TWHEEL_BITS * TWHEEL_LEVELS)) - 1;
+		delta = tick - w->clk;
+	}
+	for(level = 0 ; level < TWHEEL_LEVELS - 1 ; ++level){
+		if((delta >> (TWHEEL_BITS * (level + 1))) == 0){
+			break;
 		}
-		// FIXME need determine whether TFD_TIMER_ABSTIME ought be used
-		if(timerfd_settime(fd,0,t,NULL)){
-			close(fd);
-			free(tm);
-			return TORQUE_ERR_INVAL;
+	}
+	slot = (tick >> (TWHEEL_BITS * level)) & TWHEEL_MASK;
+	t->slot = slot;
+	timer_push(&w->slots[level][slot],t,level);
+	w->occupied[level] |= 1ull << slot;
+	++w->count;
+}
+
+static inline void
+twheel_unlink(twheel *w,torque_timer *t){
+	if( (*t->pprev = t->next) ){
+		t->next->pprev = t->pprev;
+	}
+	if(t->level < TWHEEL_LEVELS){
+		if(w->slots[t->level][t->slot] == NULL){
+			w->occupied[t->level] &= ~(1ull << t->slot);
 		}
-		if(add_fd_to_evhandler(ctx,evq,fd,timer_passthru,NULL,tm,0)){
-			close(fd);
-			free(tm);
-			return TORQUE_ERR_ASSERT;
+		--w->count;
+	}
+	t->pprev = NULL;
+}
+
+// Detach an entire slot's list of timers.
+static inline torque_timer *
+twheel_take(twheel *w,unsigned level,unsigned slot){
+	torque_timer *t = w->slots[level][slot],*cur;
+
+	for(cur = t ; cur ; cur = cur->next){
+		--w->count;
+	}
+	w->slots[level][slot] = NULL;
+	w->occupied[level] &= ~(1ull << slot);
+	return t;
+}
+
+// The tick of the wheel's next event: either the expiry of a level 0 slot,
+// or the cascade of some higher slot. A higher level's current slot has
+// already been cascaded, unless the wheel sits at its boundary.
+static uint64_t
+twheel_next(const twheel *w){
+	uint64_t next = UINT64_MAX;
+	unsigned level;
+
+	for(level = 0 ; level < TWHEEL_LEVELS ; ++level){
+		const unsigned shift = TWHEEL_BITS * level;
+		uint64_t bits = w->occupied[level],cand;
+		unsigned idx,slot;
+
+		if(bits == 0){
+			continue;
+		}
+		idx = (w->clk >> shift) & TWHEEL_MASK;
+		if(w->clk & ((1ull << shift) - 1)){
+			++idx;
+		}
+		if(idx < TWHEEL_SLOTS && (bits >> idx)){
+			slot = idx + __builtin_ctzll(bits >> idx);
+		}else{
+			slot = TWHEEL_SLOTS + __builtin_ctzll(bits);
+		}
+		cand = (((w->clk >> shift) & ~(uint64_t)TWHEEL_MASK) + slot) << shift;
+		if(cand < next){
+			next = cand;
 		}
 	}
-#elif defined(TORQUE_LINUX)
-	{
-		struct itimerval ut;
-		struct evsource *ev;
+	return next;
+}
+
+// Turn the wheel through the target tick, moving expired timers onto the due
+// list. Empty stretches of the wheel are skipped outright.
+static void
+twheel_advance(twheel *w,uint64_t target,uint64_t now){
+	while(w->count){
+		uint64_t next = twheel_next(w);
+		torque_timer *t;
+		unsigned level;
 
-		// We need add a hashed timing wheel, lest we want to support
-		// only one timer interface on Linux < 2.6.25 FIXME
-		if(ctx->eventtables.timerev){
-			free(tm);
-			return TORQUE_ERR_RESOURCE;
+		if(next > target){
+			break;
 		}
-		if((ev = create_evsources(1)) == NULL){
-			free(tm);
-			return TORQUE_ERR_RESOURCE;
+		w->clk = next;
+		for(level = 1 ; level < TWHEEL_LEVELS ; ++level){
+			const unsigned shift = TWHEEL_BITS * level;
+
+			if(w->clk & ((1ull << shift) - 1)){
+				break;
+			}
+			t = twheel_take(w,level,(w->clk >> shift) & TWHEEL_MASK);
+			while(t){
+				torque_timer *n = t->next;
+
+				twheel_link(w,t);
+				t = n;
+			}
 		}
-		ut.it_interval.tv_sec = t->it_interval.tv_sec;
-		ut.it_interval.tv_usec = t->it_interval.tv_nsec / 1000;
-		ut.it_value.tv_sec = t->it_value.tv_sec;
-		ut.it_value.tv_usec = t->it_value.tv_nsec / 1000;
-		if(setitimer(ITIMER_REAL,&ut,NULL)){
-			destroy_evsources(ev);
-			free(tm);
-			return TORQUE_ERR_INVAL;
+		t = twheel_take(w,0,w->clk & TWHEEL_MASK);
+		while(t){
+			torque_timer *n = t->next;
+
+			// Parked beyond our span (or a window reaching beyond it,
+			// in which case we're already within the window).
+			if(t->deadline > now){
+				twheel_link(w,t);
+			}else{
+				timer_push(&w->due,t,TWHEEL_DUE);
+			}
+			t = n;
 		}
-		setup_evsource(ev,0,timer_passthru,NULL,tm);
-		ctx->eventtables.timerev = ev;
-		memcpy(&ctx->eventtables.itimer,t,sizeof(*t));
+		++w->clk;
+	}
+	if(w->clk <= target){
+		w->clk = target + 1;
+	}
+}
+
+static int
+twheel_arm(twheel *w,uint64_t ns){
+#ifdef TORQUE_LINUX_TIMERFD
+	struct itimerspec its;
+
+	memset(&its,0,sizeof(its));
+	its.it_value.tv_sec = ns / 1000000000ull;
+	its.it_value.tv_nsec = ns % 1000000000ull;
+	if(timerfd_settime(w->fd,TFD_TIMER_ABSTIME,&its,NULL)){
+		return -1;
 	}
 #elif defined(TORQUE_FREEBSD)
-	{
-		EVECTOR_AUTOS(1,tk);
-		uintmax_t ms;
-
-		ms = t->it_interval.tv_sec * 1000 + t->it_interval.tv_nsec / 1000000;
-		if(!ms){
-			free(tm);
-			return TORQUE_ERR_INVAL;
+	EVECTOR_AUTOS(1,tk);
+	uint64_t now = monotonic_ns();
+	intptr_t ms = 1;
+
+	if(ns > now){
+		ms = (ns - now + 999999) / 1000000;
+	}
+	EV_SET(tk.eventv,(uintptr_t)w,EVFILT_TIMER,EV_ADD | EVONESHOT,0,ms,NULL);
+	if(Kevent(w->efd,tk.eventv,1,NULL,0)){
+		return -1;
+	}
+#else
+	return -1;
+#endif
+	w->armed = ns;
+	return 0;
+}
+
+// Arm the kernel timer for the wheel's next event, should it precede the
+// current arming. Call with the lock held.
+static int
+twheel_rearm(twheel *w){
+	uint64_t next;
+
+	if(w->count == 0){
+		return 0;
+	}
+	next = twheel_next(w) << TWHEEL_TICKSHIFT;
+	if(w->armed && w->armed <= next){
+		return 0;
+	}
+	return twheel_arm(w,next ? next : 1);
+}
+
+// Timers are taken from the due list one at a time, so that they can be
+// deleted or rescheduled (even by other threads) right up until their
+// callbacks run. While running, they sit on the idle list; a periodic timer
+// which wasn't rescheduled by its callback is then relinked into the wheel.
+// Each timer beyond the first to fire in a wakeup was coalesced into it.
+void twheel_expire(twheel *w){
+	uint64_t now = monotonic_ns();
+	evhandler *evh = get_thread_evh();
+	unsigned fired = 0;
+	torque_timer *t;
+
+	if(evh){
+		++evh->stats.timerwakeups;
+	}
+	pthread_mutex_lock(&w->lock);
+	w->armed = 0;
+	twheel_advance(w,now >> TWHEEL_TICKSHIFT,now);
+	twheel_rearm(w);
+	while( (t = w->due) ){
+		twheel_unlink(w,t);
+		timer_push(&w->idle,t,TWHEEL_IDLE);
+		++t->running;
+		pthread_mutex_unlock(&w->lock);
+		if(evh){
+			++evh->stats.timersfired;
+			if(fired++){
+				++evh->stats.timerscoalesced;
+			}
 		}
-		EV_SET(tk.eventv,(uintptr_t)tm,EVFILT_TIMER,EV_ADD | EVONESHOT,0,ms,NULL);
-		if(Kevent(evq->efd,tk.eventv,1,NULL,0)){
-			free(tm);
-			return TORQUE_ERR_RESOURCE;
+		t->tfxn(t->cbstate);
+		pthread_mutex_lock(&w->lock);
+		--t->running;
+		if(t->flags & TIMER_DEAD){
+			if(t->running == 0 && !(t->flags & TIMER_SYNC)){
+				free(t);
+			}
+		}else if(t->level == TWHEEL_IDLE){
+			if(t->interval){
+				t->deadline += t->interval;
+				if(t->deadline <= now){
+					t->deadline = now + t->interval;
+				}
+				twheel_unlink(w,t);
+				twheel_link(w,t);
+				twheel_rearm(w);
+			}else if(t->flags & TIMER_DETACHED){
+				twheel_unlink(w,t);
+				free(t);
+			}
 		}
 	}
-#else
-#error "No timer event implementation on this OS"
+	pthread_mutex_unlock(&w->lock);
+}
+
+#ifdef TORQUE_LINUX_TIMERFD
+// The expiration count is read, lest the timerfd remain readable (an emptied
+// wheel never rearms it), and level-triggered backends (io_uring's requeued
+// polls) find it ready ever after. Having been read elsewhere, it's EAGAIN.
+static void
+twheel_passthru(int fd,void *state){
+	uint64_t expirations;
+	evhandler *evh;
+
+	if(read(fd,&expirations,sizeof(expirations)) < 0 && errno != EAGAIN){
+		if( (evh = get_thread_evh()) ){
+			++evh->stats.errors;
+		}
+	}
+	twheel_expire(state);
+}
+#endif
+
+twheel *create_twheel(torque_ctx *ctx __attribute__ ((unused)),
+			const evqueue *evq __attribute__ ((unused))){
+	twheel *w;
+
+	if((w = malloc(sizeof(*w))) == NULL){
+		return NULL;
+	}
+	memset(w,0,sizeof(*w));
+	w->clk = monotonic_ns() >> TWHEEL_TICKSHIFT;
+	if(pthread_mutex_init(&w->lock,NULL)){
+		free(w);
+		return NULL;
+	}
+#ifdef TORQUE_LINUX_TIMERFD
+	if((w->fd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK | TFD_CLOEXEC)) < 0){
+		pthread_mutex_destroy(&w->lock);
+		free(w);
+		return NULL;
+	}
+	if(add_fd_to_evhandler(ctx,evq,w->fd,twheel_passthru,NULL,w,0)){
+		close(w->fd);
+		pthread_mutex_destroy(&w->lock);
+		free(w);
+		return NULL;
+	}
+#elif defined(TORQUE_FREEBSD)
+	w->efd = evq->efd;
 #endif
+	return w;
+}
+
+static void
+free_timers(torque_timer *t){
+	while(t){
+		torque_timer *n = t->next;
+
+		free(t);
+		t = n;
+	}
+}
+
+int destroy_twheel(twheel *w){
+	int ret = 0;
+
+	if(w){
+		unsigned level,slot;
+
+		for(level = 0 ; level < TWHEEL_LEVELS ; ++level){
+			for(slot = 0 ; slot < TWHEEL_SLOTS ; ++slot){
+				free_timers(w->slots[level][slot]);
+			}
+		}
+		free_timers(w->due);
+		free_timers(w->idle);
+#ifdef TORQUE_LINUX_TIMERFD
+		ret |= close(w->fd);
+#endif
+		ret |= pthread_mutex_destroy(&w->lock);
+		free(w);
+	}
+	return ret;
+}
+
+// As timerfd_settime(): a zero it_value disarms the timer, and otherwise
+// it_value is relative to now, or absolute (against CLOCK_MONOTONIC) given
+// TORQUE_TIMER_ABSTIME. Call with the lock held.
+static torque_err
+twheel_settimer(twheel *w,torque_timer *t,int flags,const struct itimerspec *its){
+	if(t->flags & TIMER_DEAD){ // deleted out from under a running callback
+		return 0;
+	}
+	t->interval = timespec_ns(&its->it_interval);
+	if(its->it_value.tv_sec == 0 && its->it_value.tv_nsec == 0){
+		if(t->level != TWHEEL_IDLE){
+			twheel_unlink(w,t);
+			timer_push(&w->idle,t,TWHEEL_IDLE);
+		}
+		return 0;
+	}
+	t->deadline = timespec_ns(&its->it_value);
+	if(!(flags & TORQUE_TIMER_ABSTIME)){
+		t->deadline += torque_now();
+	}
+	twheel_unlink(w,t);
+	twheel_link(w,t);
+	// Only a new earliest deadline requires touching the kernel timer.
+	if(twheel_rearm(w)){
+		twheel_unlink(w,t);
+		timer_push(&w->idle,t,TWHEEL_IDLE);
+		return TORQUE_ERR_RESOURCE;
+	}
 	return 0;
 }
+
+torque_err add_timer_to_evhandler(struct torque_ctx *ctx __attribute__ ((unused)),
+		const struct evqueue *evq,int flags,const struct itimerspec *its,
+		uint64_t slack,libtorquetimecb tfxn,void *cbstate,
+		torque_timer **handle){
+	twheel *w = evq->wheel;
+	torque_timer *t;
+	torque_err ret;
+
+#if defined(TORQUE_LINUX) && !defined(TORQUE_LINUX_TIMERFD)
+	return TORQUE_ERR_UNAVAIL;
+#endif
+	if((flags & ~TORQUE_TIMER_ABSTIME) || !valid_timespec(&its->it_value)
+			|| !valid_timespec(&its->it_interval)){
+		return TORQUE_ERR_INVAL;
+	}
+	if((t = malloc(sizeof(*t))) == NULL){
+		return TORQUE_ERR_RESOURCE;
+	}
+	memset(t,0,sizeof(*t));
+	t->slack = slack;
+	t->tfxn = tfxn;
+	t->cbstate = cbstate;
+	t->wheel = w;
+	t->flags = handle ? 0 : TIMER_DETACHED;
+	pthread_mutex_lock(&w->lock);
+	timer_push(&w->idle,t,TWHEEL_IDLE);
+	ret = twheel_settimer(w,t,flags,its);
+	// A detached timer which won't ever fire is of no use to anyone.
+	if(ret || (!handle && t->level == TWHEEL_IDLE)){
+		twheel_unlink(w,t);
+		free(t);
+		t = NULL;
+	}
+	pthread_mutex_unlock(&w->lock);
+	if(handle){
+		*handle = t;
+	}
+	return ret;
+}
+
+torque_err mod_timer(torque_timer *t,int flags,const struct itimerspec *its){
+	twheel *w = t->wheel;
+	torque_err ret;
+
+	if((flags & ~TORQUE_TIMER_ABSTIME) || !valid_timespec(&its->it_value)
+			|| !valid_timespec(&its->it_interval)){
+		return TORQUE_ERR_INVAL;
+	}
+	pthread_mutex_lock(&w->lock);
+	ret = twheel_settimer(w,t,flags,its);
+	pthread_mutex_unlock(&w->lock);
+	return ret;
+}
+
+void del_timer(torque_timer *t){
+	twheel *w = t->wheel;
+
+	pthread_mutex_lock(&w->lock);
+	twheel_unlink(w,t);
+	if(t->running){
+		t->flags |= TIMER_DEAD;
+	}else{
+		free(t);
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+void del_timer_sync(torque_timer *t){
+	twheel *w = t->wheel;
+
+	pthread_mutex_lock(&w->lock);
+	twheel_unlink(w,t);
+	t->flags |= TIMER_DEAD | TIMER_SYNC;
+	while(t->running){
+		pthread_mutex_unlock(&w->lock);
+		sched_yield();
+		pthread_mutex_lock(&w->lock);
+	}
+	pthread_mutex_unlock(&w->lock);
+	free(t);
+}
@@ -5,28 +5,138 @@
 extern "C" {
 #endif
 
-#include <stdlib.h>
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <libtorque/internal.h>
 
-torque_err add_timer_to_evhandler(struct torque_ctx *,
-			const struct evqueue *,const struct itimerspec *,
-			libtorquetimecb,void *)
-	__attribute__ ((warn_unused_result))
-	__attribute__ ((nonnull (1,2,3,4)));
+// Timers live in a hierarchical timing wheel, one per evqueue, driven by a
+// single kernel timer (a timerfd on Linux, an EVFILT_TIMER on FreeBSD) armed
+// for the wheel's earliest event. Each level has TWHEEL_SLOTS slots; a slot
+// of level n spans TWHEEL_SLOTS^n ticks. Timers are hashed into the lowest
+// level able to hold them, and cascaded down a level as the wheel turns
+// through the slots of the level above. Insertion and removal are O(1), and
+// all timers of an expired tick are unlinked at once. Deadlines beyond the
+// wheel's span are parked in its last slot, and reinserted when reached.
+//
+// Every timer is always on exactly one list: a slot of the wheel, the due
+// list (expired, awaiting its callback), or the idle list (disarmed, or
+// having its callback run). Cancellation and rescheduling are thus an unlink
+// and a link, and destroying the wheel reclaims all of its timers.
+//
+// A timer with slack may fire anywhere within [deadline, deadline + slack].
+// It's hashed by the instant within that window having the most trailing
+// zero bits (as the kernel's timer slack), so timers with overlapping windows
+// tend to share a tick, and thus a wakeup.
+#define TWHEEL_BITS	6
+#define TWHEEL_SLOTS	(1u << TWHEEL_BITS)
+#define TWHEEL_MASK	(TWHEEL_SLOTS - 1)
+#define TWHEEL_LEVELS	4
+#define TWHEEL_DUE	TWHEEL_LEVELS		// level of the due list
+#define TWHEEL_IDLE	(TWHEEL_LEVELS + 1)	// level of the idle list
+#define TWHEEL_TICKSHIFT 20		// 2^20ns (~1.05ms) per tick
+
+#define TIMER_DETACHED	0x1		// no handle was returned; free once done
+#define TIMER_DEAD	0x2		// deleted while running; last one out frees
+#define TIMER_SYNC	0x4		// ...unless del_timer_sync() is waiting
 
-typedef struct timerfd_marshal {
+typedef struct torque_timer {
+	struct torque_timer *next,**pprev; // list linkage
+	uint64_t deadline;		// CLOCK_MONOTONIC, in ns
+	uint64_t interval;		// period in ns, 0 if one-shot
+	uint64_t slack;			// permissible lateness in ns
 	libtorquetimecb tfxn;
 	void *cbstate;
-} timerfd_marshal;
+	struct twheel *wheel;		// the wheel we belong to
+	unsigned running;		// callbacks currently executing
+	unsigned char level,slot;	// where we're linked
+	unsigned char flags;		// TIMER_* flags
+} torque_timer;
+
+typedef struct twheel {
+	pthread_mutex_t lock;
+	uint64_t clk;			// next tick to be processed
+	uint64_t armed;			// kernel timer's expiry in ns, 0 if disarmed
+	uint64_t occupied[TWHEEL_LEVELS]; // bitmaps of nonempty slots
+	torque_timer *slots[TWHEEL_LEVELS][TWHEEL_SLOTS];
+	torque_timer *due,*idle;
+	unsigned count;			// timers linked into slots
+#ifdef TORQUE_LINUX_TIMERFD
+	int fd;				// timerfd
+#elif defined(TORQUE_FREEBSD)
+	int efd;			// kqueue hosting our EVFILT_TIMER
+#endif
+} twheel;
+
+#if defined(CLOCK_MONOTONIC_COARSE)
+#define TORQUE_CLOCK_COARSE CLOCK_MONOTONIC_COARSE
+#elif defined(CLOCK_MONOTONIC_FAST)
+#define TORQUE_CLOCK_COARSE CLOCK_MONOTONIC_FAST
+#else
+#define TORQUE_CLOCK_COARSE CLOCK_MONOTONIC
+#endif
+
+static inline uint64_t
+timespec_ns(const struct timespec *ts){
+	return ts->tv_sec * 1000000000ull + ts->tv_nsec;
+}
+
+// Non-negative and normalized, as accepted for timers and timeouts.
+static inline int
+valid_timespec(const struct timespec *ts){
+	return ts->tv_sec >= 0 && ts->tv_nsec >= 0 && ts->tv_nsec < 1000000000l;
+}
+
+static inline uint64_t
+clock_ns(clockid_t clk){
+	struct timespec ts;
 
-static inline void
-timer_curry(void *state){
-	timerfd_marshal *marsh = state;
+	clock_gettime(clk,&ts);
+	return timespec_ns(&ts);
+}
 
-	marsh->tfxn(marsh->cbstate);
-	free(marsh);
+// Expiry is always checked against the precise clock, lest a lagging coarse
+// clock find the kernel timer to have fired early, and spin rearming it.
+static inline uint64_t
+monotonic_ns(void){
+	return clock_ns(CLOCK_MONOTONIC);
 }
 
+// Create the evqueue's wheel, registering its kernel timer with the evqueue.
+twheel *create_twheel(struct torque_ctx *,const struct evqueue *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2)))
+	__attribute__ ((malloc));
+
+// Pending timers are discarded without being invoked.
+int destroy_twheel(twheel *);
+
+// Expire all timers whose deadlines have passed, and rearm the kernel timer.
+// Callbacks are invoked from the calling thread, outside of the wheel's lock.
+void twheel_expire(twheel *)
+	__attribute__ ((nonnull(1)));
+
+// A NULL handle pointer detaches the timer, which is then freed after firing
+// (if one-shot), and can't otherwise be modified. The slack (in ns) applies
+// to every expiry of the timer.
+torque_err add_timer_to_evhandler(struct torque_ctx *,const struct evqueue *,
+			int,const struct itimerspec *,uint64_t,libtorquetimecb,
+			void *,torque_timer **)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull (1,2,4,6)));
+
+torque_err mod_timer(torque_timer *,int,const struct itimerspec *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull (1,3)));
+
+void del_timer(torque_timer *)
+	__attribute__ ((nonnull (1)));
+
+// As del_timer(), but wait for any running callback to return, after which
+// the callback's state may be freed. Mustn't be called from the callback.
+void del_timer_sync(torque_timer *)
+	__attribute__ ((nonnull (1)));
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,747 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <libtorque/alloc.h>
+#include <libtorque/listen.h>
+#include <libtorque/buffers.h>
+#include <libtorque/internal.h>
+#include <libtorque/events/uring.h>
+#include <libtorque/events/thread.h>
+
+#ifdef TORQUE_LINUX_URING
+#include <sys/syscall.h>
+
+// Older kernel headers lack the multishot definitions. Kernels prior to 5.13
+// reject IORING_POLL_ADD_MULTI with EINVAL, whereupon we fall back to
+// reissuing one-shot requests for persistent sources.
+#ifndef IORING_POLL_ADD_MULTI
+#define IORING_POLL_ADD_MULTI (1U << 0)
+#endif
+#ifndef IORING_CQE_F_MORE
+#define IORING_CQE_F_MORE (1U << 1)
+#endif
+
+// The submission ring need only hold what's queued between two waits: chiefly
+// the rearms of a round's events, batched into the next wait. A round is at
+// most an evector (sized to half the L1, ie a thousand or so events), so this
+// holds a thread's round; requests in excess wait in the overflow (see
+// uring_push()) rather than being lost. The completion ring is twice as
+// large, and the kernel buffers whatever it can't hold (IORING_FEAT_NODROP).
+#define URING_ENTRIES 1024
+
+static inline int
+sys_io_uring_setup(unsigned entries,struct io_uring_params *p){
+	return syscall(__NR_io_uring_setup,entries,p);
+}
+
+static inline int
+sys_io_uring_enter(int fd,unsigned tosubmit,unsigned mincomplete,unsigned flags){
+	return syscall(__NR_io_uring_enter,fd,tosubmit,mincomplete,flags,NULL,0);
+}
+
+#ifdef TORQUE_LINUX_URING_RECV
+// A provided buffer is held only from its receive's completion until the
+// completion's dispatch, buffered_rxview() copying aside any input left
+// unconsumed, so the pool need cover only the receives completing in a round
+// or two, rather than every connection. Exhaustion merely fails receives with
+// ENOBUFS, whereupon they're reissued (see uring_received()).
+#define URING_BUFENTRIES 256	// must be a power of 2
+#define URING_BUFSIZE 8192
+#define URING_BGID 0
+
+static inline int
+sys_io_uring_register(int fd,unsigned opcode,void *arg,unsigned nargs){
+	return syscall(__NR_io_uring_register,fd,opcode,arg,nargs);
+}
+
+// Must be called with buflock held, or prior to the ring's use.
+static inline void
+uring_provide(uring *r,unsigned short tail,unsigned bid){
+	struct io_uring_buf *b = &r->bufring->bufs[tail & (r->bufentries - 1)];
+
+	b->addr = (uintptr_t)(r->bufs + bid * r->bufsize);
+	b->len = r->bufsize;
+	b->bid = bid;
+}
+
+// Return a buffer to the kernel once its contents have been delivered. A
+// buffer which can't be returned is lost to the pool for good.
+static int
+uring_recycle(uring *r,unsigned bid){
+	unsigned short tail;
+
+	if(pthread_mutex_lock(&r->buflock)){
+		return -1;
+	}
+	tail = r->bufring->tail;
+	uring_provide(r,tail,bid);
+	__sync_synchronize();
+	*(volatile unsigned short *)&r->bufring->tail = tail + 1;
+	pthread_mutex_unlock(&r->buflock);
+	return 0;
+}
+
+// Provided buffer rings require Linux 5.19. Failure leaves us without one, in
+// which case connections receive their input via poll and read(2).
+static void
+create_bufring(uring *r){
+	struct io_uring_buf_reg reg;
+	unsigned z;
+
+	r->bufentries = URING_BUFENTRIES;
+	r->bufsize = URING_BUFSIZE;
+	if((r->bufring = get_pages(r->bufentries * sizeof(*r->bufring->bufs))) == NULL){
+		return;
+	}
+	if((r->bufs = get_pages(r->bufentries * r->bufsize)) == NULL){
+		dealloc(r->bufring,r->bufentries * sizeof(*r->bufring->bufs));
+		r->bufring = NULL;
+		return;
+	}
+	memset(&reg,0,sizeof(reg));
+	reg.ring_addr = (uintptr_t)r->bufring;
+	reg.ring_entries = r->bufentries;
+	reg.bgid = URING_BGID;
+	if(sys_io_uring_register(r->fd,IORING_REGISTER_PBUF_RING,&reg,1) ||
+			pthread_mutex_init(&r->buflock,NULL)){
+		dealloc(r->bufs,r->bufentries * r->bufsize);
+		dealloc(r->bufring,r->bufentries * sizeof(*r->bufring->bufs));
+		r->bufring = NULL;
+		return;
+	}
+	for(z = 0 ; z < r->bufentries ; ++z){
+		uring_provide(r,z,z);
+	}
+	__sync_synchronize();
+	r->bufring->tail = r->bufentries;
+}
+
+static void
+destroy_bufring(uring *r){
+	if(r->bufring){
+		pthread_mutex_destroy(&r->buflock);
+		dealloc(r->bufs,r->bufentries * r->bufsize);
+		dealloc(r->bufring,r->bufentries * sizeof(*r->bufring->bufs));
+	}
+}
+#endif
+
+uring *create_uring(void){
+	struct io_uring_params p;
+	unsigned *array,z;
+	size_t cqlen;
+	char *map;
+	uring *r;
+
+	if((r = malloc(sizeof(*r))) == NULL){
+		return NULL;
+	}
+	memset(&p,0,sizeof(p));
+	if((r->fd = sys_io_uring_setup(URING_ENTRIES,&p)) < 0){
+		free(r);
+		return NULL;
+	}
+	// Without IORING_FEAT_NODROP (Linux 5.5), completions in excess of the
+	// completion ring's capacity are lost, and with them their sources.
+	// Every kernel providing it also provides IORING_FEAT_SINGLE_MMAP.
+	if(!(p.features & IORING_FEAT_NODROP)){
+		close(r->fd);
+		free(r);
+		errno = ENOSYS;
+		return NULL;
+	}
+	r->ringmaplen = p.sq_off.array + p.sq_entries * sizeof(*array);
+	cqlen = p.cq_off.cqes + p.cq_entries * sizeof(*r->cqes);
+	if(cqlen > r->ringmaplen){
+		r->ringmaplen = cqlen;
+	}
+	if((r->ringmap = mmap(NULL,r->ringmaplen,PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE,r->fd,IORING_OFF_SQ_RING)) == MAP_FAILED){
+		close(r->fd);
+		free(r);
+		return NULL;
+	}
+	r->sqesmaplen = p.sq_entries * sizeof(*r->sqes);
+	if((r->sqes = mmap(NULL,r->sqesmaplen,PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE,r->fd,IORING_OFF_SQES)) == MAP_FAILED){
+		munmap(r->ringmap,r->ringmaplen);
+		close(r->fd);
+		free(r);
+		return NULL;
+	}
+	map = r->ringmap;
+	r->sqhead = (void *)(map + p.sq_off.head);
+	r->sqtail = (void *)(map + p.sq_off.tail);
+	r->sqmask = (void *)(map + p.sq_off.ring_mask);
+	r->cqhead = (void *)(map + p.cq_off.head);
+	r->cqtail = (void *)(map + p.cq_off.tail);
+	r->cqmask = (void *)(map + p.cq_off.ring_mask);
+	r->cqes = (void *)(map + p.cq_off.cqes);
+	// Submission slots are always used in ring order, so the indirection
+	// array is the identity mapping, and need never again be written.
+	array = (void *)(map + p.sq_off.array);
+	for(z = 0 ; z < p.sq_entries ; ++z){
+		array[z] = z;
+	}
+	r->sqentries = p.sq_entries;
+	r->overflow = NULL;
+	r->overflown = r->overflowcap = 0;
+	r->multishot = 1;
+	r->recvmulti = 1;
+	if(pthread_mutex_init(&r->sqlock,NULL)){
+		goto err;
+	}
+	if(pthread_mutex_init(&r->cqlock,NULL)){
+		pthread_mutex_destroy(&r->sqlock);
+		goto err;
+	}
+#ifdef TORQUE_LINUX_URING_RECV
+	create_bufring(r);
+#endif
+	return r;
+
+err:
+	munmap(r->sqes,r->sqesmaplen);
+	munmap(r->ringmap,r->ringmaplen);
+	close(r->fd);
+	free(r);
+	return NULL;
+}
+
+int destroy_uring(uring *r){
+	int ret = 0;
+
+	if(r){
+#ifdef TORQUE_LINUX_URING_RECV
+		destroy_bufring(r);
+#endif
+		ret |= pthread_mutex_destroy(&r->cqlock);
+		ret |= pthread_mutex_destroy(&r->sqlock);
+		ret |= munmap(r->sqes,r->sqesmaplen);
+		ret |= munmap(r->ringmap,r->ringmaplen);
+		ret |= close(r->fd);
+		free(r->overflow);
+		free(r);
+	}
+	return ret;
+}
+
+// Must be called with sqlock held. Only we advance the tail; the kernel
+// advances the head as it consumes entries.
+static struct io_uring_sqe *
+uring_get_sqe(uring *r){
+	unsigned tail = *r->sqtail;
+
+	if(tail - *(volatile unsigned *)r->sqhead >= r->sqentries){
+		// The ring is full; hand everything queued to the kernel.
+		if(sys_io_uring_enter(r->fd,r->sqentries,0,0) < 0 && errno != EBUSY){
+			return NULL;
+		}
+		if(tail - *(volatile unsigned *)r->sqhead >= r->sqentries){
+			errno = EBUSY;
+			return NULL;
+		}
+	}
+	return &r->sqes[tail & *r->sqmask];
+}
+
+// Must be called with sqlock held.
+static int
+uring_put(uring *r,const struct io_uring_sqe *s){
+	struct io_uring_sqe *sqe;
+
+	if((sqe = uring_get_sqe(r)) == NULL){
+		return -1;
+	}
+	*sqe = *s;
+	__sync_synchronize();
+	*(volatile unsigned *)r->sqtail = *r->sqtail + 1;
+	return 0;
+}
+
+// Must be called with sqlock held. Move what we can of the overflow onto the
+// submission ring, in order. Returns -1 if any remains.
+static int
+uring_unoverflow(uring *r){
+	unsigned z;
+
+	for(z = 0 ; z < r->overflown ; ++z){
+		if(uring_put(r,&r->overflow[z])){
+			break;
+		}
+	}
+	if(z){
+		r->overflown -= z;
+		memmove(r->overflow,r->overflow + z,sizeof(*r->overflow) * r->overflown);
+	}
+	return r->overflown ? -1 : 0;
+}
+
+// Must be called with sqlock held. A request finding the submission ring full
+// (the kernel refusing more with EBUSY while completions are backlogged, or
+// anything else keeping it from consuming submissions) is held in the
+// overflow, and pushed behind anything already there once the ring has room.
+// We thus fail only if the overflow can't be grown.
+static int
+uring_push(uring *r,const struct io_uring_sqe *s){
+	evhandler *evh = get_thread_evh();
+
+	if(uring_unoverflow(r) == 0 && uring_put(r,s) == 0){
+		return 0;
+	}
+	if(r->overflown == r->overflowcap){
+		unsigned cap = r->overflowcap ? r->overflowcap * 2 : r->sqentries;
+		struct io_uring_sqe *tmp;
+
+		if((tmp = realloc(r->overflow,sizeof(*tmp) * cap)) == NULL){
+			return -1;
+		}
+		r->overflow = tmp;
+		r->overflowcap = cap;
+	}
+	r->overflow[r->overflown++] = *s;
+	if(evh){
+		++evh->stats.uringoverflows;
+	}
+	return 0;
+}
+
+// Retry the overflow, ahead of a wait submitting the ring's contents.
+static void
+uring_flush(uring *r){
+	if(r->overflown && pthread_mutex_lock(&r->sqlock) == 0){
+		uring_unoverflow(r);
+		pthread_mutex_unlock(&r->sqlock);
+	}
+}
+
+// Event threads of the evqueue will submit the request as part of their next
+// wait. Anyone else must submit it now, lest it languish. EBUSY indicates a
+// completion backlog; the request remains queued, as does one held in the
+// overflow.
+static int
+uring_submit(const evqueue *evq,const struct io_uring_sqe *s){
+	const evhandler *evh = get_thread_evh();
+	uring *r = evq->ring;
+	int ret;
+
+	if(pthread_mutex_lock(&r->sqlock)){
+		return -1;
+	}
+	ret = uring_push(r,s);
+	if(ret == 0 && (evh == NULL || evh->evq != evq)){
+		if(sys_io_uring_enter(r->fd,r->sqentries,0,0) < 0 && errno != EBUSY){
+			ret = -1;
+		}
+	}
+	pthread_mutex_unlock(&r->sqlock);
+	return ret;
+}
+
+// The request's flags and fd are carried through to its completions in the
+// user_data.
+static inline void
+prep_poll(const uring *r,struct io_uring_sqe *sqe,int fd,unsigned events){
+	memset(sqe,0,sizeof(*sqe));
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	if(!(events & EPOLLONESHOT) && r->multishot){
+		sqe->len = IORING_POLL_ADD_MULTI;
+	}
+	sqe->user_data = ((uint64_t)events << 32) | ((unsigned)fd << 3) | URING_OP_POLL;
+}
+
+int uring_add(const evqueue *evq,int fd,unsigned events){
+	struct io_uring_sqe sqe;
+
+	prep_poll(evq->ring,&sqe,fd,events);
+	return uring_submit(evq,&sqe);
+}
+
+// Only an allocation failure (see uring_push()) can keep the request from
+// being queued, leaving the source deaf; this is counted as uringlost.
+static inline void
+uring_requeue(evhandler *e,int fd,unsigned events){
+	if(uring_add(e->evq,fd,events)){
+		++e->stats.uringlost;
+	}
+}
+
+// Persistent sources must be requeued whenever their request terminates:
+// always, absent multishot support, and otherwise whenever the kernel drops
+// the multishot request (indicated by the absence of IORING_CQE_F_MORE).
+// Completions of other requests are copied out to the evhandler's cqev.
+// Without block, we return once queued submissions have been handed to the
+// kernel and the completion ring found empty; this requires no system call
+// when there's nothing to submit, making for cheap spinning.
+int uring_retrieve(evhandler *e,int block){
+	kevententry *events = PTR_TO_EVENTV(&e->evec)->events;
+	uring *r = e->evq->ring;
+	int n = 0,woke = 0;
+
+	for( ; ; ){
+		unsigned head,tail;
+
+		if(pthread_mutex_lock(&r->cqlock)){
+			return -1;
+		}
+		head = *r->cqhead;
+		tail = *(volatile unsigned *)r->cqtail;
+		__sync_synchronize();
+		while(head != tail && n < e->evec.vsizes){
+			const struct io_uring_cqe *cqe = &r->cqes[head & *r->cqmask];
+			unsigned flags = cqe->user_data >> 32;
+			int fd = (cqe->user_data & 0xffffffffu) >> 3;
+
+			++head;
+			memset(&events[n],0,sizeof(events[n]));
+			if((cqe->user_data & URING_OP_MASK) == URING_OP_NOP){
+				continue;
+			}else if((cqe->user_data & URING_OP_MASK) != URING_OP_POLL){
+				e->cqev[n] = *cqe;
+				events[n].events = URING_EVCQE;
+				events[n].data.u32 = n;
+				++n;
+				continue;
+			}
+			if(cqe->res < 0){
+				if(cqe->res == -EINVAL && r->multishot &&
+						!(flags & EPOLLONESHOT)){
+					r->multishot = 0;
+					uring_requeue(e,fd,flags);
+				}
+				continue;
+			}
+			events[n].events = cqe->res;
+			events[n].data.fd = fd;
+			++n;
+			if(!(flags & EPOLLONESHOT) && !(cqe->flags & IORING_CQE_F_MORE)){
+				uring_requeue(e,fd,flags);
+			}
+		}
+		__sync_synchronize();
+		*(volatile unsigned *)r->cqhead = head;
+		pthread_mutex_unlock(&r->cqlock);
+		if(n){
+			return n;
+		}
+		if(woke){ // only discarded completions, or none at all
+			++e->stats.spuriouswakes;
+		}
+		uring_flush(r);
+		if(!block){
+			if(*(volatile unsigned *)r->sqtail == *(volatile unsigned *)r->sqhead){
+				return 0;
+			}
+			if(sys_io_uring_enter(r->fd,r->sqentries,0,0) < 0 && errno != EBUSY){
+				return -1;
+			}
+			continue;
+		}
+		++e->stats.uringenters;
+		if(sys_io_uring_enter(r->fd,r->sqentries,1,IORING_ENTER_GETEVENTS) < 0){
+			if(errno != EBUSY){
+				return -1;
+			}
+		}
+		woke = 1;
+	}
+}
+
+#ifdef TORQUE_LINUX_URING_RECV
+// A connection receiving its input via provided buffers. Each is owned by the
+// one thread processing its outstanding receive, save on private evqueues
+// (where there is only one thread anyway), where a multishot receive is used.
+// A client closing the fd leaves a multishot receive holding the socket open,
+// and so it must be cancelled (a cancellation which can't be queued leaves the
+// socket open until the peer closes it, and is counted as uringlost). Output the socket won't immediately take waits
+// upon a one-shot poll for writability. The connection is freed once neither
+// request remains outstanding.
+typedef struct uring_conn {
+	torque_rxbufcb rxcb;		// client callbacks, residual input, output
+	const evqueue *evq;		// evqueue upon which we receive
+	int fd;
+	int multishot;			// using a multishot receive
+	int closed;			// closed by the client (or closing once
+					//  written); awaiting cancellation
+	int recvdone;			// the receive has terminated
+	int sending;			// awaiting writability
+	int parked;			// receive deferred until written
+} uring_conn;
+
+static void
+free_uring_conn(uring_conn *c){
+	free_rxbuffercb(&c->rxcb);
+	free(c);
+}
+
+static void
+uring_recv_done(uring_conn *c){
+	c->recvdone = 1;
+	if(!c->sending){
+		free_uring_conn(c);
+	}
+}
+
+static int
+uring_queue_recv(uring_conn *c){
+	struct io_uring_sqe sqe;
+
+	memset(&sqe,0,sizeof(sqe));
+	sqe.opcode = IORING_OP_RECV;
+	sqe.fd = c->fd;
+	sqe.flags = IOSQE_BUFFER_SELECT;
+	sqe.buf_group = URING_BGID;
+	if(c->multishot){
+		sqe.ioprio = IORING_RECV_MULTISHOT;
+	}
+	sqe.user_data = (uintptr_t)c | URING_OP_RECV;
+	return uring_submit(c->evq,&sqe);
+}
+
+static int
+uring_cancel_recv(uring_conn *c){
+	struct io_uring_sqe sqe;
+
+	memset(&sqe,0,sizeof(sqe));
+	sqe.opcode = IORING_OP_ASYNC_CANCEL;
+	sqe.fd = -1;
+	sqe.addr = (uintptr_t)c | URING_OP_RECV;
+	sqe.user_data = URING_OP_NOP;
+	return uring_submit(c->evq,&sqe);
+}
+
+// Write what we can, awaiting writability for the remainder.
+static int
+uring_send(uring_conn *c){
+	struct io_uring_sqe sqe;
+
+	if(txbuffer_flush(&c->rxcb.txbuf)){
+		return -1;
+	}
+	if(c->rxcb.txbuf.head == NULL || c->sending){
+		return 0;
+	}
+	memset(&sqe,0,sizeof(sqe));
+	sqe.opcode = IORING_OP_POLL_ADD;
+	sqe.fd = c->fd;
+	sqe.poll32_events = EPOLLOUT;
+	sqe.user_data = (uintptr_t)c | URING_OP_SEND;
+	if(uring_submit(c->evq,&sqe)){
+		return -1;
+	}
+	c->sending = 1;
+	return 0;
+}
+
+// The fd's been closed, by the client or by us.
+static void
+uring_conn_closed(uring_conn *c){
+	c->closed = 1;
+	c->rxcb.txbuf.closing = 0;
+	discard_txbuffer(&c->rxcb.txbuf);
+}
+
+// The client's callbacks have given up the fd, having either closed it, or
+// asked that we do so once its output is written.
+static void
+uring_conn_done(uring_conn *c){
+	if(!c->rxcb.txbuf.closing){
+		uring_conn_closed(c);
+	}else if(uring_send(c) || c->rxcb.txbuf.head == NULL){
+		close(c->fd);
+		uring_conn_closed(c);
+	}else{
+		c->closed = 1;
+	}
+}
+
+int uring_accept(const evqueue *evq,torque_listener *l){
+	struct io_uring_sqe sqe;
+
+	memset(&sqe,0,sizeof(sqe));
+	sqe.opcode = IORING_OP_ACCEPT;
+	sqe.fd = l->sd;
+	sqe.accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe.user_data = (uintptr_t)l | URING_OP_ACCEPT;
+	return uring_submit(evq,&sqe);
+}
+
+int uring_addconn(const evqueue *evq,int sd,libtorquebrcb rx,void *cbstate){
+	const torque_ctx *ctx = get_thread_ctx();
+	uring_conn *c;
+
+	if((c = malloc(sizeof(*c))) == NULL){
+		return -1;
+	}
+	memset(c,0,sizeof(*c));
+	init_rxbuffercb(&c->rxcb,sd,rx,NULL,cbstate);
+	c->evq = evq;
+	c->fd = sd;
+	c->multishot = ctx && ctx->opts.evqmode == TORQUE_EVQ_THREAD &&
+			evq->ring->recvmulti;
+	if(uring_queue_recv(c)){
+		free(c);
+		return -1;
+	}
+	return 0;
+}
+
+// The listener's multishot accept is reissued should it terminate, unless the
+// listener itself is no longer usable (ie, it's been closed), which is counted
+// as acceptstops. A reissue held in the overflow (see uring_push()) is merely
+// delayed; one which can't be queued at all is counted as uringlost.
+static void
+uring_accepted(torque_ctx *ctx,torque_listener *l,const struct io_uring_cqe *cqe){
+	evhandler *evh = get_thread_evh();
+
+	if(cqe->res >= 0){
+		if(listener_addconn(ctx,l,cqe->res)){
+			close(cqe->res);
+		}
+	}
+	if(!(cqe->flags & IORING_CQE_F_MORE)){
+		if(cqe->res == -EBADF || cqe->res == -EINVAL ||
+				cqe->res == -ENOTSOCK || cqe->res == -ECANCELED){
+			++evh->stats.acceptstops;
+		}else if(uring_accept(evh->evq,l)){
+			++evh->stats.uringlost;
+		}
+	}
+}
+
+// Input is delivered in place, and its buffer immediately returned to the
+// kernel (buffered_rxview() copies aside anything not consumed). EOF is
+// delivered as empty input. As with buffered_rxfxn(), we're responsible for
+// closing the fd on any internal error. Output queued by the callback is
+// written following its return. On shared evqueues, the next receive awaits
+// the writing of any output the socket wouldn't take, so that the receive
+// and the poll for writability never complete on two threads at once.
+static void
+uring_received(uring_conn *c,const struct io_uring_cqe *cqe){
+	uring *r = c->evq->ring;
+	int more = cqe->flags & IORING_CQE_F_MORE;
+	int wasclosed = c->closed;
+	int cb = 0;
+
+	if(cqe->flags & IORING_CQE_F_BUFFER){
+		unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+		if(!c->closed && cqe->res > 0){
+			cb = buffered_rxview(c->fd,&c->rxcb,r->bufs + bid * r->bufsize,cqe->res);
+		}
+		if(uring_recycle(r,bid)){
+			++get_thread_evh()->stats.bufringlost;
+		}
+	}else if(!c->closed && cqe->res == 0){
+		c->rxcb.rxdone = 1;
+		cb = buffered_rxview(c->fd,&c->rxcb,NULL,0);
+	}
+	if(cb > 0){
+		uring_conn_done(c);
+	}else if(cb < 0){
+		uring_conn_closed(c);
+	}else if(!c->closed && cqe->res >= 0 && uring_send(c)){
+		close(c->fd);
+		uring_conn_closed(c);
+	}
+	if(c->closed){
+		if(!more){
+			uring_recv_done(c);
+		}else if(!wasclosed && uring_cancel_recv(c)){
+			++get_thread_evh()->stats.uringlost;
+		}
+		return;
+	}
+	if(more){
+		return;
+	}
+	if(cqe->res == 0){ // EOF, and the client retains the fd
+		uring_recv_done(c);
+		return;
+	}
+	if(cqe->res == -EINVAL && c->multishot){
+		r->recvmulti = c->multishot = 0;
+	}else if(cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -EINTR &&
+			cqe->res != -EAGAIN){
+		close(c->fd);
+		uring_conn_closed(c);
+		uring_recv_done(c);
+		return;
+	}
+	if(c->sending){
+		c->parked = 1;
+		return;
+	}
+	if(uring_queue_recv(c)){
+		close(c->fd);
+		uring_conn_closed(c);
+		uring_recv_done(c);
+	}
+}
+
+// Writability (or an error) for queued output. Should the client have closed
+// the fd meanwhile, its output was discarded, and the fd might now be
+// another's; we mustn't touch it.
+static void
+uring_sent(uring_conn *c,const struct io_uring_cqe *cqe){
+	torque_txbuf *txb = &c->rxcb.txbuf;
+
+	c->sending = 0;
+	if(!c->closed || txb->closing){
+		int wasclosed = c->closed;
+
+		if(cqe->res < 0 || uring_send(c)){
+			close(c->fd);
+			uring_conn_closed(c);
+			if(!wasclosed && !c->recvdone && !c->parked &&
+					uring_cancel_recv(c)){
+				++get_thread_evh()->stats.uringlost;
+			}
+		}else if(txb->head == NULL && txb->closing){
+			close(c->fd);
+			uring_conn_closed(c);
+		}
+	}
+	if(c->parked && !c->sending){
+		c->parked = 0;
+		if(c->closed){
+			c->recvdone = 1;
+		}else if(uring_queue_recv(c)){
+			close(c->fd);
+			uring_conn_closed(c);
+			c->recvdone = 1;
+		}
+	}
+	if(c->recvdone && !c->sending){
+		free_uring_conn(c);
+	}
+}
+#endif
+
+void uring_handle_cqe(torque_ctx *ctx __attribute__ ((unused)),
+			const struct io_uring_cqe *cqe){
+	void *state = (void *)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_OP_MASK);
+
+	switch(cqe->user_data & URING_OP_MASK){
+#ifdef TORQUE_LINUX_URING_RECV
+	case URING_OP_ACCEPT:
+		uring_accepted(ctx,state,cqe);
+		break;
+	case URING_OP_RECV:
+		uring_received(state,cqe);
+		break;
+	case URING_OP_SEND:
+		uring_sent(state,cqe);
+		break;
+#endif
+	default: // we issue no other requests whose completions come here
+		++get_thread_evh()->stats.errors;
+		break;
+	}
+}
+#endif
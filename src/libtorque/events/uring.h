@@ -0,0 +1,112 @@
+#ifndef LIBTORQUE_EVENTS_URING
+#define LIBTORQUE_EVENTS_URING
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libtorque/events/sysdep.h>
+
+#ifdef TORQUE_LINUX_URING
+#include <pthread.h>
+#include <linux/io_uring.h>
+#include <libtorque/torque.h>
+
+// Provided buffer rings and multishot accept arrived in Linux 5.19, and
+// multishot receive in 6.0 (the latter is detected at runtime).
+#ifdef IORING_RECV_MULTISHOT
+#define TORQUE_LINUX_URING_RECV
+#endif
+
+struct evqueue;
+struct evhandler;
+struct torque_ctx;
+struct torque_listener;
+
+// The low bits of a request's user_data identify the operation. Polls carry
+// their fd and event flags; the remainder carry a pointer to their state.
+#define URING_OP_POLL	0x0	// events << 32 | fd << 3
+#define URING_OP_ACCEPT	0x1	// torque_listener *
+#define URING_OP_RECV	0x2	// uring_conn *
+#define URING_OP_NOP	0x3	// completion to be discarded
+#define URING_OP_SEND	0x4	// uring_conn *, awaiting writability
+#define URING_OP_MASK	0x7
+
+// Completions other than those of polls are handed to the event loop intact.
+// Such an event carries this flag (never a valid poll result), with the index
+// of the completion in the evhandler's cqev as its data.
+#define URING_EVCQE (1U << 16)
+
+// An io_uring serving an evqueue in place of its epoll set. Readiness is
+// tracked with poll requests: one-shot requests for one-shot sources, and
+// multishot requests (where the kernel supports them) for the remainder.
+// Submissions are queued under sqlock, and handed to the kernel by the next
+// io_uring_enter() of any thread waiting on the ring; those finding the
+// submission ring full are held in the overflow until it has room. Completions
+// are reaped under cqlock.
+typedef struct uring {
+	int fd;				// io_uring file descriptor
+	unsigned sqentries;		// submission ring size
+	unsigned *sqhead,*sqtail,*sqmask;
+	unsigned *cqhead,*cqtail,*cqmask;
+	struct io_uring_sqe *sqes;	// submission queue entries
+	struct io_uring_cqe *cqes;	// completion queue entries
+	void *ringmap;			// single mapping of both rings
+	size_t ringmaplen,sqesmaplen;
+	struct io_uring_sqe *overflow;	// requests awaiting submission slots
+	unsigned overflown,overflowcap;
+	int multishot;			// kernel accepts IORING_POLL_ADD_MULTI
+	int recvmulti;			// kernel accepts IORING_RECV_MULTISHOT
+#ifdef TORQUE_LINUX_URING_RECV
+	struct io_uring_buf_ring *bufring; // provided buffers, NULL if unsupported
+	char *bufs;			// backing store for bufring
+	unsigned bufentries;		// number of provided buffers
+	size_t bufsize;			// size of each provided buffer
+	pthread_mutex_t buflock;	// serializes replenishing of bufring
+#endif
+	pthread_mutex_t sqlock,cqlock;
+} uring;
+
+uring *create_uring(void)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((malloc));
+
+int destroy_uring(uring *);
+
+// Queue a poll request for the fd, using epoll-style event flags. The request
+// is submitted immediately unless the caller is an event thread waiting on
+// this evqueue, in which case it is batched into that thread's next wait.
+int uring_add(const struct evqueue *,int,unsigned)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
+// Submit any queued requests, and fill the evhandler's event vector with at
+// least one completion, blocking if necessary (and the second parameter is
+// non-zero; otherwise 0 is returned). Returns as Kevent().
+int uring_retrieve(struct evhandler *,int)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
+// Dispatch a completion handed to the event loop via URING_EVCQE.
+void uring_handle_cqe(struct torque_ctx *,const struct io_uring_cqe *)
+	__attribute__ ((nonnull(1,2)));
+
+#ifdef TORQUE_LINUX_URING_RECV
+// Queue a multishot accept on the listener. Accepted sockets are nonblocking.
+int uring_accept(const struct evqueue *,struct torque_listener *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2)));
+
+// Receive input on the connected socket into provided buffers, delivering it
+// in place to the buffered read callback.
+int uring_addconn(const struct evqueue *,int,libtorquebrcb,void *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+#endif
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -10,3 +10,39 @@ STATDEF(stacksize)	// stack size in bytes
 
 // Events we track, especially errors
 STATDEF(pollerr)	// errors in the core event retrieval call
+STATDEF(rearms)		// event source modifications via restorefd()
+STATDEF(rearmsaved)	// restorefd() modifications elided (private evq)
+STATDEF(uringenters)	// io_uring_enter() calls made waiting on events
+STATDEF(uringoverflows)	// io_uring requests held awaiting submission slots
+STATDEF(uringlost)	// io_uring requests which couldn't be queued at all
+STATDEF(bufringlost)	// provided buffers which couldn't be returned
+STATDEF(acceptstops)	// multishot accepts ended by their listener's closing
+STATDEF(evecsize)	// events last requested per round (adaptive)
+STATDEF(spinhits)	// rounds whose events were found while spinning
+STATDEF(spinmisses)	// spin windows expiring without events
+STATDEF(spuriouswakes)	// wakeups whose events found no work (see torque_opts)
+STATDEF(lfhandoffs)	// leaderships handed to parked followers
+
+// Priority lanes (see torque_prio); latencies are summed from retrieval to
+// the start of the lane's dispatch, so divide by the lane's events.
+STATDEF(ctlevents)	// TORQUE_PRIO_CONTROL events dispatched
+STATDEF(ctllatns)	// TORQUE_PRIO_CONTROL total latency (ns)
+STATDEF(normevents)	// TORQUE_PRIO_NORMAL events dispatched via lanes
+STATDEF(normlatns)	// TORQUE_PRIO_NORMAL total latency (ns)
+STATDEF(bulkevents)	// TORQUE_PRIO_BULK events dispatched
+STATDEF(bulklatns)	// TORQUE_PRIO_BULK total latency (ns)
+STATDEF(lanedeferrals)	// events left in a lane at the end of a round
+STATDEF(lanestale)	// deferred events dropped, their fd set up anew
+STATDEF(lanemerged)	// events merged into their fd's deferred event
+STATDEF(signals)	// signals received via signalfd
+STATDEF(sigreads)	// signalfd reads (batched; compare with signals)
+STATDEF(posts)		// tasks run from torque_post()
+STATDEF(postdrains)	// batches of posted tasks taken
+STATDEF(timersfired)	// timer callbacks invoked
+STATDEF(timerwakeups)	// kernel timer expirations handled
+STATDEF(timerscoalesced) // timers fired by another's wakeup (see slack)
+STATDEF(timeouts)	// connections closed by their timeouts
+STATDEF(zcsends)	// MSG_ZEROCOPY sends (see torque_txzerocopy())
+STATDEF(zccopied)	// zerocopy completions reporting a copy regardless
+STATDEF(respbatches)	// RESP command batches dispatched
+STATDEF(respcmds)	// RESP commands dispatched (see respbatches)
@@ -0,0 +1,261 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <libtorque/frame.h>
+#include <libtorque/buffers.h>
+#include <libtorque/internal.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FRAME_SIMD
+#include <immintrin.h>
+#endif
+
+static size_t
+scan_scalar(const char *buf,size_t len,char c){
+	const char *p;
+
+	if((p = memchr(buf,c,len)) == NULL){
+		return len;
+	}
+	return p - buf;
+}
+
+#ifdef FRAME_SIMD
+// The kernels compare a vector at a time, using unaligned loads, and leave
+// the tail to memchr(3). They're compiled for their instruction sets
+// regardless of -march, and only called should the processors support them.
+__attribute__ ((target("sse2"))) static size_t
+scan_sse2(const char *buf,size_t len,char c){
+	const __m128i needle = _mm_set1_epi8(c);
+	size_t off = 0;
+
+	while(len - off >= 16){
+		__m128i v = _mm_loadu_si128((const __m128i *)(buf + off));
+		unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(v,needle));
+
+		if(m){
+			return off + __builtin_ctz(m);
+		}
+		off += 16;
+	}
+	return off + scan_scalar(buf + off,len - off,c);
+}
+
+// Two vectors per iteration, tested together, to amortize the branch.
+__attribute__ ((target("avx2"))) static size_t
+scan_avx2(const char *buf,size_t len,char c){
+	const __m256i needle = _mm256_set1_epi8(c);
+	size_t off = 0;
+
+	while(len - off >= 64){
+		__m256i a = _mm256_loadu_si256((const __m256i *)(buf + off));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(buf + off + 32));
+		__m256i ea = _mm256_cmpeq_epi8(a,needle);
+		__m256i eb = _mm256_cmpeq_epi8(b,needle);
+
+		if(!_mm256_testz_si256(_mm256_or_si256(ea,eb),_mm256_or_si256(ea,eb))){
+			unsigned m = _mm256_movemask_epi8(ea);
+
+			if(m){
+				return off + __builtin_ctz(m);
+			}
+			return off + 32 + __builtin_ctz((unsigned)_mm256_movemask_epi8(eb));
+		}
+		off += 64;
+	}
+	while(len - off >= 32){
+		__m256i v = _mm256_loadu_si256((const __m256i *)(buf + off));
+		unsigned m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v,needle));
+
+		if(m){
+			return off + __builtin_ctz(m);
+		}
+		off += 32;
+	}
+	return off + scan_scalar(buf + off,len - off,c);
+}
+#endif
+
+// The widest kernel supported by every x86 processor type of the machine.
+framescanfxn pick_scanfxn(const torque_ctx *ctx){
+#ifdef FRAME_SIMD
+	unsigned sse2 = 1,avx2 = 1,x86 = 0,z;
+
+	for(z = 0 ; z < ctx->cpu_typecount ; ++z){
+		const torque_cput *cpu = &ctx->cpudescs[z];
+
+		if(cpu->isa != TORQUE_ISA_X86){
+			continue;
+		}
+		++x86;
+		sse2 &= cpu->spec.x86.features.sse2;
+		avx2 &= cpu->spec.x86.features.avx2;
+	}
+	if(x86 && avx2){
+		return scan_avx2;
+	}else if(x86 && sse2){
+		return scan_sse2;
+	}
+#else
+	(void)ctx;
+#endif
+	return scan_scalar;
+}
+
+int framer_valid(const torque_framer *tf){
+	switch(tf->mode){
+	case TORQUE_FRAME_FIXED:
+		return tf->len != 0;
+	case TORQUE_FRAME_PREFIX_BE: case TORQUE_FRAME_PREFIX_LE:
+		return tf->len != 0 && tf->len <= sizeof(uint64_t);
+	case TORQUE_FRAME_DELIM:
+		return tf->delim != NULL && tf->delimlen != 0;
+	}
+	return 0;
+}
+
+rxframer *create_rxframer(const torque_ctx *ctx,const torque_framer *tf,
+				libtorqueframecb framefxn,void *cbstate){
+	size_t delimlen = tf->mode == TORQUE_FRAME_DELIM ? tf->delimlen : 0;
+	rxframer *ret;
+
+	if( (ret = malloc(sizeof(*ret) + delimlen)) ){
+		ret->framefxn = framefxn;
+		ret->cbstate = cbstate;
+		ret->scanfxn = pick_scanfxn(ctx);
+		ret->mode = tf->mode;
+		ret->len = tf->len;
+		ret->maxframe = tf->maxframe;
+		ret->scanned = ret->need = 0;
+		ret->failed = 0;
+		ret->delimlen = delimlen;
+		memcpy(ret->delim,tf->delim,delimlen);
+	}
+	return ret;
+}
+
+static uint64_t
+frame_prefix(const rxframer *fr,const unsigned char *buf){
+	uint64_t ret = 0;
+	size_t z;
+
+	if(fr->mode == TORQUE_FRAME_PREFIX_BE){
+		for(z = 0 ; z < fr->len ; ++z){
+			ret = (ret << 8u) | buf[z];
+		}
+	}else{
+		for(z = fr->len ; z ; --z){
+			ret = (ret << 8u) | buf[z - 1];
+		}
+	}
+	return ret;
+}
+
+// Search the pending frame's input for the delimiter, resuming where the last
+// search left off. A match of the delimiter's first byte too near the end of
+// the input to be checked is searched again once more input arrives.
+static int
+frame_delim(rxframer *fr,const char *buf,size_t valid,size_t *poff,size_t *plen){
+	size_t off = fr->scanned;
+
+	while(off < valid){
+		off += fr->scanfxn(buf + off,valid - off,fr->delim[0]);
+		if(off == valid){
+			break;
+		}
+		if(valid - off < fr->delimlen){
+			break;
+		}
+		if(memcmp(buf + off,fr->delim,fr->delimlen) == 0){
+			if(fr->maxframe && off > fr->maxframe){
+				return -1;
+			}
+			*poff = 0;
+			*plen = off;
+			fr->need = off + fr->delimlen;
+			return 1;
+		}
+		++off;
+	}
+	fr->scanned = off;
+	if(fr->maxframe && off > fr->maxframe){
+		return -1;
+	}
+	return 0;
+}
+
+// 1 if the pending frame is complete, setting fr->need to its length, 0 if
+// more input is required, and -1 if the frame exceeds maxframe.
+static int
+frame_next(rxframer *fr,const char *buf,size_t valid,size_t *poff,size_t *plen){
+	uint64_t plen64;
+
+	switch(fr->mode){
+	case TORQUE_FRAME_FIXED:
+		fr->need = fr->len;
+		*poff = 0;
+		break;
+	case TORQUE_FRAME_PREFIX_BE: case TORQUE_FRAME_PREFIX_LE:
+		*poff = fr->len;
+		if(fr->need == 0){
+			if(valid < fr->len){
+				return 0;
+			}
+			plen64 = frame_prefix(fr,(const unsigned char *)buf);
+			if((fr->maxframe && plen64 > fr->maxframe) ||
+					plen64 > SIZE_MAX - fr->len){
+				return -1;
+			}
+			fr->need = fr->len + plen64;
+		}
+		break;
+	case TORQUE_FRAME_DELIM: default:
+		return frame_delim(fr,buf,valid,poff,plen);
+	}
+	if(valid < fr->need){
+		return 0;
+	}
+	*plen = fr->need - *poff;
+	return 1;
+}
+
+// Frames are released as the callback returns from them. Once input has
+// ended (buffered_rxfxn() marks rxdone before calling us), whatever remains
+// is a partial frame.
+int framed_rxfxn(int fd,torque_rxbuf *rxb,void *v){
+	torque_rxbufcb *cbctx = v;
+	rxframer *fr = cbctx->rxproto;
+	const char *buf;
+	size_t valid;
+
+	for( ; ; ){
+		size_t poff,plen,flen;
+		int r,cb;
+
+		buf = rxbuffer_valid(rxb,&valid);
+		if(fr->failed){
+			rxbuffer_advance(rxb,valid);
+			return 0;
+		}
+		if((r = frame_next(fr,buf,valid,&poff,&plen)) == 0){
+			break;
+		}else if(r < 0){
+			fr->failed = 1;
+			rxbuffer_advance(rxb,valid);
+			shutdown(fd,SHUT_RD);
+			return fr->framefxn(fd,rxb,NULL,0,fr->cbstate);
+		}
+		flen = fr->need;
+		fr->scanned = fr->need = 0;
+		if( (cb = fr->framefxn(fd,rxb,buf + poff,plen,fr->cbstate)) ){
+			return cb;
+		}
+		rxbuffer_advance(rxb,flen);
+	}
+	if(cbctx->rxdone){
+		rxbuffer_advance(rxb,valid);
+		return fr->framefxn(fd,rxb,NULL,0,fr->cbstate);
+	}
+	return 0;
+}
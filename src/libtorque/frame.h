@@ -0,0 +1,49 @@
+#ifndef TORQUE_FRAME
+#define TORQUE_FRAME
+
+#include <stddef.h>
+#include <libtorque/torque.h>
+
+// Returns the offset of the first instance of the byte within the buffer, or
+// the buffer's length if there is none.
+typedef size_t (*framescanfxn)(const char *,size_t,char);
+
+// The fastest search supported by all of the machine's processors.
+framescanfxn pick_scanfxn(const struct torque_ctx *)
+	__attribute__ ((nonnull(1)));
+
+// A framed connection's read callback and framing state. Only the pending
+// (first unconsumed) frame is tracked: for delimited frames, how much of its
+// input has already been searched, and for prefixed frames, its length once
+// the prefix has been read. Both are relative to the start of the frame, and
+// thus survive the input being copied aside (see rxview()).
+typedef struct rxframer {
+	libtorqueframecb framefxn;
+	void *cbstate;			// userspace callback state
+	framescanfxn scanfxn;		// chosen for the processors
+	torque_framing mode;
+	size_t len;			// frame length, or prefix width
+	size_t maxframe;		// largest payload (0 for no limit)
+	size_t scanned;			// pending frame's input already searched
+	size_t need;			// pending frame's length, once known
+	int failed;			// oversized frame; input is discarded
+	size_t delimlen;
+	char delim[];
+} rxframer;
+
+// Non-zero if the framing is one we can implement.
+int framer_valid(const torque_framer *)
+	__attribute__ ((nonnull(1)));
+
+rxframer *create_rxframer(const struct torque_ctx *,const torque_framer *,
+				libtorqueframecb,void *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2,3)))
+	__attribute__ ((malloc));
+
+// The buffered read callback of framed connections (see buffered_rxfxn()),
+// delivering each complete frame to the framer's callback.
+int framed_rxfxn(int,struct torque_rxbuf *,void *)
+	__attribute__ ((nonnull(2,3)));
+
+#endif
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <libtorque/internal.h>
+#include <libtorque/events/evq.h>
 #include <libtorque/hardware/cuda.h>
 #include <libtorque/hardware/arch.h>
 #include <libtorque/hardware/memory.h>
@@ -159,6 +160,25 @@ detect_cpucount(cpu_set_t *mask){
 	return 0;
 }
 
+// Event threads size their event vectors relative to their L1 data caches (see
+// events/thread.c), and the number of threads with which they share.
+static void
+note_evqueue_thread(evqueue *evq,unsigned aid,const torque_cput *cpu){
+	unsigned z;
+
+	++evq->threads;
+	CPU_SET(aid,&evq->cpus);
+	for(z = 0 ; z < cpu->memories ; ++z){
+		const torque_memt *mem = &cpu->memdescs[z];
+
+		if(mem->level == 1 && mem->memtype != MEMTYPE_CODE && mem->totalsize){
+			if(evq->l1dsize == 0 || mem->totalsize < evq->l1dsize){
+				evq->l1dsize = mem->totalsize;
+			}
+		}
+	}
+}
+
 // Might leave the calling thread pinned to a particular processor; restore the
 // CPU mask if necessary after a call.
 static torque_err
@@ -187,6 +207,7 @@ detect_cputypes(torque_ctx *ctx,unsigned *cputc,torque_cput **types){
 		unsigned thread,core,pkg;
 		torque_cput cpudetails;
 		typeof(*types) cputype;
+		evqueue *evq;
 
 		while(aid < CPU_SETSIZE && !CPU_ISSET(aid,&mask)){
 			++aid;
@@ -212,7 +233,12 @@ detect_cputypes(torque_ctx *ctx,unsigned *cputc,torque_cput **types){
 		if( (ret = topologize(ctx,topmap,aid,thread,core,pkg,(unsigned)(cputype - *types))) ){
 			goto err;
 		}
-		if(spawn_thread(ctx)){
+		if((evq = get_group_evqueue(ctx,pkg,core)) == NULL){
+			ret = TORQUE_ERR_RESOURCE;
+			goto err;
+		}
+		note_evqueue_thread(evq,aid,cputype);
+		if(spawn_thread(ctx,evq)){
 			ret = TORQUE_ERR_RESOURCE;
 			goto err;
 		}
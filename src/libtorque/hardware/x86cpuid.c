@@ -41,6 +41,7 @@ typedef enum {
 	CPUID_STANDARD_CACHECONF	=       0x00000004, // cache config
 	CPUID_STANDARD_MWAIT		=       0x00000005, // MWAIT/MONITOR
 	CPUID_STANDARD_POWERMAN		=       0x00000006, // power management
+	CPUID_STANDARD_EXTFEATURES	=       0x00000007, // extended features
 	CPUID_STANDARD_DIRECTCACHE	=       0x00000009, // DCA access setup
 	CPUID_STANDARD_PERFMON		=       0x0000000a, // performance ctrs
 	CPUID_STANDARD_TOPOLOGY		=       0x0000000b, // topology, x2apic
@@ -1720,6 +1721,7 @@ id_intel_topology(uint32_t maxfunc,const struct feature_flags *ff,torque_cput *c
 #define FFLAG_POPCNT		0x00800000u // bit 23, POPCNT instruction
 #define FFLAG_AES		0x02000000u // bit 25, AESni instructions
 #define FFLAG_XSAVE		0x04000000u // bit 26, XSAVE/XRSTOR/X[SG]ETBV
+#define FFLAG_OSXSAVE		0x08000000u // bit 27, XSAVE enabled by the OS
 #define FFLAG_AVX		0x10000000u // bit 28, AVX
 #define FFLAG_RDRAND		0x40000000u // bit 30, RDRAND
 
@@ -1732,6 +1734,44 @@ id_intel_topology(uint32_t maxfunc,const struct feature_flags *ff,torque_cput *c
 #define FFLAG_SSE2		0x04000000u // bit 26
 #define FFLAG_HT		0x10000000u // bit 28
 
+// CPUID function 00000007 (subleaf 0) EBX feature flags
+#define FFLAG7_AVX2		0x00000020u // bit 5, AVX2
+
+// XCR0 bits: the OS saves and restores SSE (XMM) and AVX (YMM) state
+#define XCR0_SSE_AVX		0x00000006u
+
+static inline uint32_t
+xgetbv(uint32_t xcr){
+	uint32_t lo,hi;
+
+	__asm__ __volatile__(
+		"xgetbv\n\t"
+		: "=a" (lo), "=d" (hi)
+		: "c" (xcr)
+	);
+	return lo;
+}
+
+// AVX (and thus AVX2) is only usable should the OS save the YMM registers
+// across context switches, as reported via XGETBV.
+static void
+x86_getavx(uint32_t maxfunc,uint32_t ecx,x86_details *cpu){
+	uint32_t gpregs[4];
+
+	if(!(ecx & FFLAG_AVX) || !(ecx & FFLAG_OSXSAVE)){
+		return;
+	}
+	if((xgetbv(0) & XCR0_SSE_AVX) != XCR0_SSE_AVX){
+		return;
+	}
+	cpu->features.avx = 1;
+	if(maxfunc < CPUID_STANDARD_EXTFEATURES){
+		return;
+	}
+	cpuid(CPUID_STANDARD_EXTFEATURES,0,gpregs);
+	cpu->features.avx2 = !!(gpregs[1] & FFLAG7_AVX2);
+}
+
 static int
 x86_getprocsig(uint32_t maxfunc,x86_details *cpu,struct feature_flags *ff){
 	uint32_t gpregs[4],maxex;
@@ -1752,6 +1792,7 @@ x86_getprocsig(uint32_t maxfunc,x86_details *cpu,struct feature_flags *ff){
 	cpu->features.sse41 = !!(gpregs[2] & FFLAG_SSE41);
 	cpu->features.sse42 = !!(gpregs[2] & FFLAG_SSE42);
 	cpu->features.sse4a = !!(gpregs[2] & FFLAG_SSE4A);
+	x86_getavx(maxfunc,gpregs[2],cpu);
 	ff->dca = !!(gpregs[2] & FFLAG_DCA);
 	ff->x2apic = !!(gpregs[2] & FFLAG_X2APIC);
 	ff->pse = !!(gpregs[3] & FFLAG_PSE);
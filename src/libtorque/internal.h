@@ -9,6 +9,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <libtorque/torque.h>
 #include <libtorque/schedule.h>
@@ -101,7 +102,10 @@ typedef struct x86_details {
 		// Never implemented. AMD broke SSE5 down into XOP/FMA4/CVT16
 		// unsigned sse5 : 1;
 		// Introduces the VEX encoding scheme, 256-bit YMM registers.
+		// Only set if the OS saves the YMM state (XCR0).
 		unsigned avx : 1;
+		// Introduced on Haswell. Extends integer SSE ops to YMM's.
+		unsigned avx2 : 1;
 		// Main VEX/AVX support, scheduled for AMD Bulldozer.
 		unsigned xop : 1;
 		unsigned fma4 : 1;
@@ -140,19 +144,33 @@ typedef struct evtables {
 	struct evsource *fdarray,*sigarray;
 	unsigned sigarraysize,fdarraysize;
 #ifdef TORQUE_LINUX_SIGNALFD
+	// All signals are received through the one signalfd, registered with
+	// every evqueue. Registrations extend its mask, under siglock.
 	int common_signalfd;
-#endif
-#if defined(TORQUE_LINUX) && !defined(TORQUE_LINUX_TIMERFD)
-	struct itimerval itimer;
-	struct evsource *timerev;
+	sigset_t common_sigset;
+	pthread_mutex_t siglock;
 #endif
 } evtables;
 
-// evqueues are shared among some number (possibly 1) of threads. currently,
-// all threads share a single evqueue, but this will almost certainly change..
+// evqueues are shared among some number (possibly 1) of threads. By default,
+// all threads share a single evqueue (the context's evq). When partitioned
+// (see torque_evqmode), there is one evqueue per scheduling group at the
+// requested level of the sched_zone; the context's evq is the first of these,
+// and the remainder are chained from it.
 typedef struct evqueue {
 	int efd;			// epoll() or kqueue() file descriptor
+#ifdef TORQUE_LINUX_URING
+	struct uring *ring;		// io_uring backend, replacing efd
+#endif
 	dns_state dnsctx;		// DNS resolution state
+	struct twheel *wheel;		// timers (see events/timer.h)
+	struct postq *postq;		// posted tasks (see events/post.h)
+	cpu_set_t cpus;			// processors whose threads wait here
+	unsigned package,core;		// scheduling group served, if partitioned
+	unsigned threads;		// event threads sharing the evqueue
+	struct evleader *lf;		// leader/follower state, if in use
+	uintmax_t l1dsize;		// their smallest L1 dcache, 0 if unknown
+	struct evqueue *next;		// next evqueue of the context
 } evqueue;
 
 // Whenever a field is added to this structure, make sure it's
@@ -162,7 +180,10 @@ typedef struct evqueue {
 // and as it was then restricted (ie, only those processing elements in our
 // cpuset, and only those NUMA nodes which we can reach).
 typedef struct torque_ctx {
-	evqueue evq;			// shared evq
+	evqueue evq;			// shared (or first partitioned) evq
+	unsigned evqcount;		// number of evqueues chained from evq
+	unsigned evqrr;			// round-robin evqueue selector
+	torque_opts opts;		// parameters in effect (see init_evqueue())
 	unsigned nodecount;		// number of NUMA nodes
 	unsigned cpu_typecount;		// number of processing element types
 	torque_cput *cpudescs;		// dynarray of cpu_typecount elements
@@ -170,6 +191,7 @@ typedef struct torque_ctx {
 	torque_topt *sched_zone;	// interconnection DAG (see topology.h)
 	evtables eventtables;		// callback state tables
 	struct evhandler *ev;		// evhandler of list leader FIXME purge
+	int prioritized;		// sources exist outside TORQUE_PRIO_NORMAL
 } torque_ctx;
 
 #endif
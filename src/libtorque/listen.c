@@ -0,0 +1,84 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <libtorque/listen.h>
+#include <libtorque/internal.h>
+#include <libtorque/events/fd.h>
+#include <libtorque/events/evq.h>
+#include <libtorque/events/uring.h>
+#include <libtorque/events/thread.h>
+
+torque_listener *create_listener(int sd,libtorquebrcb rx,libtorquebwcb tx,void *state){
+	torque_listener *ret;
+
+	if( (ret = malloc(sizeof(*ret))) ){
+		ret->cbstate = state;
+		ret->txfxn = tx;
+		ret->rxfxn = rx;
+		ret->sd = sd;
+	}
+	return ret;
+}
+
+// On io_uring evqueues, buffered connections lacking a write callback receive
+// their input via provided buffers (see events/uring.c). Anything else goes
+// through torque_addfd(), onto the evqueue local to the accepting thread.
+int listener_addconn(torque_ctx *ctx,const torque_listener *l,int sd){
+#ifdef TORQUE_LINUX_URING_RECV
+	const evhandler *evh = get_thread_evh();
+
+	if(l->txfxn == NULL && evh && evh->evq->ring && evh->evq->ring->bufring){
+		busypoll_fd(ctx,sd);
+		return uring_addconn(evh->evq,sd,l->rxfxn,l->cbstate);
+	}
+#endif
+	return torque_addfd(ctx,sd,l->rxfxn,l->txfxn,l->cbstate) ? -1 : 0;
+}
+
+// Registered as a concurrent source, so several threads might be accepting
+// from the listener at once (hence looping until EAGAIN). accept4(2) saves us
+// the two fcntl(2)s otherwise necessary to make the new socket nonblocking.
+// A thread finding no connection at all lost the race to another thread (or
+// evqueue), and was woken for nothing.
+void listener_rxfxn(int fd,void *cbstate){
+	const torque_listener *l = cbstate;
+	torque_ctx *ctx = get_thread_ctx();
+	unsigned accepted = 0;
+	int sd;
+
+	for( ; ; ){
+#ifdef SOCK_NONBLOCK
+		if((sd = accept4(fd,NULL,NULL,SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0){
+#else
+		int flags;
+
+		if((sd = accept(fd,NULL,NULL)) < 0){
+#endif
+			if(errno == EINTR || errno == ECONNABORTED){
+				continue;
+			}
+			if(accepted == 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+				++get_thread_evh()->fruitless;
+			}
+			break; // FIXME stat on errors other than EAGAIN
+		}
+		++accepted;
+#ifndef SOCK_NONBLOCK
+		if(((flags = fcntl(sd,F_GETFL)) < 0) || fcntl(sd,F_SETFL,flags | O_NONBLOCK)){
+			close(sd);
+			continue;
+		}
+#endif
+		if(listener_addconn(ctx,l,sd)){
+			close(sd);
+		}
+	}
+}
+
+void free_listener(torque_listener *l){
+	if(l){
+		free(l);
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef TORQUE_LISTEN
+#define TORQUE_LISTEN
+
+#include <libtorque/torque.h>
+
+// A listening socket, each of whose connections is to be registered with the
+// buffered callbacks and state provided.
+typedef struct torque_listener {
+	libtorquebrcb rxfxn;
+	libtorquebwcb txfxn;
+	void *cbstate;			// userspace callback state
+	int sd;				// listening socket
+} torque_listener;
+
+torque_listener *create_listener(int,libtorquebrcb,libtorquebwcb,void *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((malloc));
+
+// Accept and register all pending connections (when not using io_uring).
+void listener_rxfxn(int,void *);
+
+// Register a socket accepted on behalf of the listener.
+int listener_addconn(struct torque_ctx *,const torque_listener *,int)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2)));
+
+void free_listener(torque_listener *);
+
+#endif
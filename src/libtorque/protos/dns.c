@@ -19,7 +19,7 @@ int torque_dns_init(dns_state *dctx){
 	return 0;
 }
 
-int restore_dns_fds(dns_state dctx __attribute__ ((unused)),const evhandler *evh){
+int restore_dns_fds(dns_state dctx __attribute__ ((unused)),evhandler *evh){
 #ifndef LIBTORQUE_WITHOUT_ADNS
 	int nfds,to = 0,r,ret = 0;
 	struct pollfd pfds[4];
@@ -99,20 +99,20 @@ adns_tx_callback(int fd,void *state){
 	};
 	struct timeval now;
 
-	if(gettimeofday(&now,NULL)){
+	if(round_timeval(&now)){
 		// FIXME what?
 	}
 	adns_afterpoll(state,&pfd,1,&now); // FIXME add back?
 }
 #endif
 
-int load_dns_fds(torque_ctx *ctx,dns_state *dctx,const evqueue *evq){
+int load_dns_fds(torque_ctx *ctx,const dns_state *dctx,const evqueue *evq){
 #ifndef LIBTORQUE_WITHOUT_ADNS
 	struct pollfd pfds[4];
 	int nfds,to = 0,r;
 
 	nfds = sizeof(pfds) / sizeof(*pfds);
-	if( (r = adns_beforepoll(ctx->evq.dnsctx,pfds,&nfds,&to,NULL)) ){
+	if( (r = adns_beforepoll(*dctx,pfds,&nfds,&to,NULL)) ){
 		if(r == ERANGE){
 			// FIXME go back with more space
 		}
@@ -26,11 +26,11 @@ int torque_dns_init(dns_state *)
 	__attribute__ ((warn_unused_result))
 	__attribute__ ((nonnull(1)));
 
-int load_dns_fds(struct torque_ctx *,dns_state *,const struct evqueue *)
+int load_dns_fds(struct torque_ctx *,const dns_state *,const struct evqueue *)
 	__attribute__ ((warn_unused_result))
 	__attribute__ ((nonnull(1,2,3)));
 
-int restore_dns_fds(dns_state,const struct evhandler *);
+int restore_dns_fds(dns_state,struct evhandler *);
 
 void torque_dns_shutdown(dns_state *);
 
@@ -0,0 +1,409 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <libtorque/buffers.h>
+#include <libtorque/protos/http.h>
+
+httpparser *create_httpparser(const torque_ctx *ctx,size_t maxbody,
+				libtorquehttpcb reqfxn,void *cbstate){
+	httpparser *ret;
+
+	if( (ret = malloc(sizeof(*ret))) ){
+		memset(ret,0,sizeof(*ret));
+		ret->reqfxn = reqfxn;
+		ret->cbstate = cbstate;
+		ret->scanfxn = pick_scanfxn(ctx);
+		ret->maxbody = maxbody;
+		ret->state = HTTP_HEAD;
+	}
+	return ret;
+}
+
+static inline int
+http_ows(char c){
+	return c == ' ' || c == '\t';
+}
+
+// Case-insensitive comparison of a slice against a token.
+static inline int
+http_token(const char *s,size_t len,const char *tok){
+	return strlen(tok) == len && strncasecmp(s,tok,len) == 0;
+}
+
+static int
+http_hexval(char c){
+	if(c >= '0' && c <= '9'){
+		return c - '0';
+	}else if(c >= 'a' && c <= 'f'){
+		return c - 'a' + 10;
+	}else if(c >= 'A' && c <= 'F'){
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+// A line's length, excluding its terminator, given the offset of its LF.
+static inline size_t
+http_linelen(const char *line,size_t lf){
+	return lf && line[lf - 1] == '\r' ? lf - 1 : lf;
+}
+
+// Find the empty line ending the header block, resuming the search at the
+// last line ending seen: 1 having set headlen, 0 if more input is needed, and
+// -1 should the block be too large.
+static int
+http_headend(httpparser *hp,const char *buf,size_t valid){
+	size_t off = hp->scanned;
+
+	while((off += hp->scanfxn(buf + off,valid - off,'\n')) < valid){
+		size_t next = off + 1;
+
+		if(next < valid && buf[next] == '\r'){
+			++next;
+		}
+		if(next >= valid){
+			break; // we can't yet tell whether the next line is empty
+		}
+		if(buf[next] == '\n'){
+			hp->headlen = next + 1;
+			return hp->headlen > HTTP_MAXHEAD ? -1 : 1;
+		}
+		off = next;
+	}
+	hp->scanned = off;
+	return off > HTTP_MAXHEAD ? -1 : 0;
+}
+
+static int
+http_contentlen(const char *s,size_t len,size_t *clen){
+	size_t z,v = 0;
+
+	if(len == 0){
+		return -1;
+	}
+	for(z = 0 ; z < len ; ++z){
+		if(s[z] < '0' || s[z] > '9' || v > (SIZE_MAX - 9) / 10){
+			return -1;
+		}
+		v = v * 10 + (s[z] - '0');
+	}
+	*clen = v;
+	return 0;
+}
+
+// Only chunked transfer coding is understood, and it must come last.
+static int
+http_chunked(const char *s,size_t len){
+	size_t z = len;
+
+	while(z && s[z - 1] != ',' && !http_ows(s[z - 1])){
+		--z;
+	}
+	return http_token(s + z,len - z,"chunked") ? 0 : -1;
+}
+
+static void
+http_connection(const char *s,size_t len,int *keepalive){
+	while(len){
+		size_t z = 0;
+
+		while(z < len && s[z] != ','){
+			++z;
+		}
+		if(http_token(s,z,"close")){
+			*keepalive = 0;
+		}else if(http_token(s,z,"keep-alive")){
+			*keepalive = 1;
+		}
+		s += z;
+		len -= z;
+		while(len && (*s == ',' || http_ows(*s))){
+			++s;
+			--len;
+		}
+	}
+}
+
+static int
+http_reqline(const char *line,size_t len,torque_httpreq *req){
+	const char *sp1,*sp2;
+
+	if((sp1 = memchr(line,' ',len)) == NULL || sp1 == line){
+		return -1;
+	}
+	if((sp2 = memchr(sp1 + 1,' ',len - (sp1 + 1 - line))) == NULL || sp2 == sp1 + 1){
+		return -1;
+	}
+	if(line + len - (sp2 + 1) != 8 || memcmp(sp2 + 1,"HTTP/1.",7) ||
+			sp2[8] < '0' || sp2[8] > '9'){
+		return -1;
+	}
+	req->method = line;
+	req->methodlen = sp1 - line;
+	req->target = sp1 + 1;
+	req->targetlen = sp2 - (sp1 + 1);
+	req->minor = sp2[8] - '0';
+	req->keepalive = req->minor >= 1;
+	return 0;
+}
+
+// Parse the complete header block, line by line, extracting what bears upon
+// the body's framing. Obsolete line folding, a Content-Length alongside (or
+// contradicting) another, and transfer codings other than chunked are all
+// rejected, lest we frame the body differently than an intermediary did.
+static int
+http_parsehead(const httpparser *hp,const char *buf,torque_httpreq *req,
+				int *chunked,size_t *clen){
+	size_t off,lf,len;
+	int haveclen = 0;
+
+	lf = hp->scanfxn(buf,hp->headlen,'\n');
+	if(http_reqline(buf,http_linelen(buf,lf),req)){
+		return -1;
+	}
+	req->headercount = 0;
+	*chunked = 0;
+	*clen = 0;
+	for(off = lf + 1 ; off < hp->headlen ; off += lf + 1){
+		const char *line = buf + off,*colon,*val;
+		torque_httphdr *h;
+		size_t vlen;
+
+		lf = hp->scanfxn(line,hp->headlen - off,'\n');
+		if((len = http_linelen(line,lf)) == 0){
+			break;
+		}
+		if(http_ows(*line) || (colon = memchr(line,':',len)) == NULL ||
+				colon == line || http_ows(colon[-1])){
+			return -1;
+		}
+		if(req->headercount == TORQUE_HTTP_MAXHEADERS){
+			return -1;
+		}
+		val = colon + 1;
+		vlen = len - (val - line);
+		while(vlen && http_ows(*val)){
+			++val;
+			--vlen;
+		}
+		while(vlen && http_ows(val[vlen - 1])){
+			--vlen;
+		}
+		h = &req->headers[req->headercount++];
+		h->name = line;
+		h->namelen = colon - line;
+		h->value = val;
+		h->valuelen = vlen;
+		if(http_token(h->name,h->namelen,"content-length")){
+			size_t v;
+
+			if(http_contentlen(val,vlen,&v) || (haveclen && v != *clen)){
+				return -1;
+			}
+			haveclen = 1;
+			*clen = v;
+		}else if(http_token(h->name,h->namelen,"transfer-encoding")){
+			if(http_chunked(val,vlen)){
+				return -1;
+			}
+			*chunked = 1;
+		}else if(http_token(h->name,h->namelen,"connection")){
+			http_connection(val,vlen,&req->keepalive);
+		}
+	}
+	return *chunked && haveclen ? -1 : 0;
+}
+
+// Chunk extensions are ignored.
+static int
+http_chunksize(const char *line,size_t len,size_t *size){
+	size_t z,s = 0;
+	int d;
+
+	for(z = 0 ; z < len && (d = http_hexval(line[z])) >= 0 ; ++z){
+		if(s > (SIZE_MAX >> 4u)){
+			return -1;
+		}
+		s = (s << 4u) | (unsigned)d;
+	}
+	if(z == 0 || (z < len && line[z] != ';' && !http_ows(line[z]))){
+		return -1;
+	}
+	*size = s;
+	return 0;
+}
+
+// Decode chunked input in place. 1 once the body's complete, having set
+// reqlen, 0 if more input is needed, and -1 if it's malformed or too large.
+// While in the trailers, scanned holds their start.
+static int
+http_dechunk(httpparser *hp,char *buf,size_t valid,size_t *reqlen){
+	for( ; ; ){
+		const char *raw = buf + hp->rawoff;
+		size_t avail = valid - hp->rawoff,lf,n;
+
+		switch(hp->state){
+		case HTTP_CHUNKSIZE: case HTTP_TRAILER:
+			if((lf = hp->scanfxn(raw,avail,'\n')) == avail){
+				return avail > HTTP_MAXLINE ? -1 : 0;
+			}
+			if(lf > HTTP_MAXLINE){
+				return -1;
+			}
+			hp->rawoff += lf + 1;
+			n = http_linelen(raw,lf);
+			if(hp->state == HTTP_TRAILER){
+				if(n == 0){
+					*reqlen = hp->rawoff;
+					return 1;
+				}
+				if(hp->rawoff - hp->scanned > HTTP_MAXHEAD){
+					return -1;
+				}
+			}else if(http_chunksize(raw,n,&hp->chunkleft)){
+				return -1;
+			}else if(hp->chunkleft == 0){
+				hp->state = HTTP_TRAILER;
+				hp->scanned = hp->rawoff;
+			}else if(hp->maxbody && hp->chunkleft > hp->maxbody - hp->bodylen){
+				return -1;
+			}else{
+				hp->state = HTTP_CHUNKDATA;
+			}
+			break;
+		case HTTP_CHUNKDATA:
+			if((n = hp->chunkleft < avail ? hp->chunkleft : avail) == 0){
+				return 0;
+			}
+			memmove(buf + hp->headlen + hp->bodylen,raw,n);
+			hp->bodylen += n;
+			hp->rawoff += n;
+			if((hp->chunkleft -= n) == 0){
+				hp->state = HTTP_CHUNKEND;
+			}
+			break;
+		case HTTP_CHUNKEND:
+			if(avail && *raw == '\n'){
+				hp->rawoff += 1;
+			}else if(avail >= 2 && raw[0] == '\r' && raw[1] == '\n'){
+				hp->rawoff += 2;
+			}else if(avail == 0 || (avail == 1 && *raw == '\r')){
+				return 0;
+			}else{
+				return -1;
+			}
+			hp->state = HTTP_CHUNKSIZE;
+			break;
+		default:
+			return -1;
+		}
+	}
+}
+
+static inline void
+http_reset(httpparser *hp){
+	hp->state = HTTP_HEAD;
+	hp->scanned = hp->headlen = hp->rawoff = 0;
+	hp->bodylen = hp->chunkleft = 0;
+}
+
+// 1 if the pending request is complete, having filled in req and set its
+// length, 0 if more input is needed, and -1 if it's malformed.
+static int
+http_request(httpparser *hp,char *buf,size_t valid,torque_httpreq *req,
+						size_t *reqlen){
+	int parsed = 0,chunked,r;
+	size_t clen;
+
+	if(hp->state == HTTP_HEAD){
+		if((r = http_headend(hp,buf,valid)) <= 0){
+			return r;
+		}
+		if(http_parsehead(hp,buf,req,&chunked,&clen)){
+			return -1;
+		}
+		if(chunked){
+			hp->state = HTTP_CHUNKSIZE;
+			hp->rawoff = hp->headlen;
+			hp->bodylen = 0;
+		}else{
+			if((hp->maxbody && clen > hp->maxbody) ||
+					clen > SIZE_MAX - hp->headlen){
+				return -1;
+			}
+			hp->state = HTTP_BODY;
+			hp->bodylen = clen;
+		}
+		parsed = 1;
+	}
+	if(hp->state == HTTP_BODY){
+		if(valid - hp->headlen < hp->bodylen){
+			return 0;
+		}
+		*reqlen = hp->headlen + hp->bodylen;
+	}else if((r = http_dechunk(hp,buf,valid,reqlen)) <= 0){
+		return r;
+	}
+	if(!parsed && http_parsehead(hp,buf,req,&chunked,&clen)){
+		return -1;
+	}
+	req->body = buf + hp->headlen;
+	req->bodylen = hp->bodylen;
+	http_reset(hp);
+	return 1;
+}
+
+static int
+http_fail(int fd,torque_rxbuf *rxb,httpparser *hp){
+	hp->failed = 1;
+	rxbuffer_advance(rxb,rxb->bufoff - rxb->bufate);
+	shutdown(fd,SHUT_RD);
+	return hp->reqfxn(fd,rxb,NULL,hp->cbstate);
+}
+
+// Requests are released as the callback returns from them. Empty lines
+// preceding a request line are skipped (RFC 7230, 3.5). The input is written
+// to, in decoding chunked bodies, and so isn't taken via rxbuffer_valid().
+int http_rxfxn(int fd,torque_rxbuf *rxb,void *v){
+	torque_rxbufcb *cbctx = v;
+	httpparser *hp = cbctx->rxproto;
+	torque_httpreq req;
+
+	if(hp->failed){
+		rxbuffer_advance(rxb,rxb->bufoff - rxb->bufate);
+		return 0;
+	}
+	for( ; ; ){
+		char *buf = rxb->buffer + rxb->bufate;
+		size_t valid = rxb->bufoff - rxb->bufate,reqlen;
+		int r,cb;
+
+		if(hp->state == HTTP_HEAD && hp->scanned == 0){
+			size_t z = 0;
+
+			while(z < valid && (buf[z] == '\r' || buf[z] == '\n')){
+				++z;
+			}
+			if(z){
+				rxbuffer_advance(rxb,z);
+				continue;
+			}
+		}
+		if((r = http_request(hp,buf,valid,&req,&reqlen)) == 0){
+			break;
+		}else if(r < 0){
+			return http_fail(fd,rxb,hp);
+		}
+		if( (cb = hp->reqfxn(fd,rxb,&req,hp->cbstate)) ){
+			return cb;
+		}
+		rxbuffer_advance(rxb,reqlen);
+	}
+	if(cbctx->rxdone){
+		rxbuffer_advance(rxb,rxb->bufoff - rxb->bufate);
+		return hp->reqfxn(fd,rxb,NULL,hp->cbstate);
+	}
+	return 0;
+}
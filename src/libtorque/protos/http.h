@@ -0,0 +1,60 @@
+#ifndef LIBTORQUE_PROTOS_HTTP
+#define LIBTORQUE_PROTOS_HTTP
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <libtorque/frame.h>
+#include <libtorque/torque.h>
+
+#define HTTP_MAXHEAD	(64u << 10)	// request line and headers
+#define HTTP_MAXLINE	1024u		// chunk size and trailer lines
+
+typedef enum {
+	HTTP_HEAD,			// awaiting the end of the header block
+	HTTP_BODY,			// awaiting a Content-Length body
+	HTTP_CHUNKSIZE,			// awaiting a chunk size line
+	HTTP_CHUNKDATA,			// within a chunk's data
+	HTTP_CHUNKEND,			// awaiting the CRLF following chunk data
+	HTTP_TRAILER,			// within the trailers
+} http_state;
+
+// A connection's parser, holding only the progress of the pending (first
+// unconsumed) request, as offsets from its start. The header block is parsed
+// once complete, and parsed again upon delivery should the body not have
+// been complete by then (the input might since have moved). Chunked bodies
+// are decoded in place, the data of each chunk being moved down over the
+// framing preceding it, so that the decoded body directly follows the header
+// block.
+typedef struct httpparser {
+	libtorquehttpcb reqfxn;
+	void *cbstate;			// userspace callback state
+	framescanfxn scanfxn;		// see pick_scanfxn()
+	size_t maxbody;			// 0 for no limit
+	http_state state;
+	size_t scanned;			// header block searched for its end
+	size_t headlen;			// header block's length, once complete
+	size_t rawoff;			// chunked input consumed
+	size_t bodylen;			// Content-Length, or decoded thus far
+	size_t chunkleft;		// remaining data of the current chunk
+	int failed;			// malformed request; input is discarded
+} httpparser;
+
+httpparser *create_httpparser(const struct torque_ctx *,size_t,
+				libtorquehttpcb,void *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,3)))
+	__attribute__ ((malloc));
+
+// The buffered read callback of HTTP connections (see buffered_rxfxn()),
+// delivering each complete request to the parser's callback.
+int http_rxfxn(int,struct torque_rxbuf *,void *)
+	__attribute__ ((nonnull(2,3)));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
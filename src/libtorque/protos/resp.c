@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <libtorque/buffers.h>
+#include <libtorque/events/thread.h>
+#include <libtorque/protos/resp.h>
+
+#define RESP_TOOMANY	2	// more arguments than the batch has room for
+
+respparser *create_respparser(const torque_ctx *ctx,libtorquerespcb cmdfxn,
+				void *cbstate){
+	respparser *ret;
+
+	if( (ret = malloc(sizeof(*ret))) ){
+		memset(ret,0,sizeof(*ret));
+		ret->cmdfxn = cmdfxn;
+		ret->cbstate = cbstate;
+		ret->scanfxn = pick_scanfxn(ctx);
+	}
+	return ret;
+}
+
+static inline int
+resp_space(char c){
+	return c == ' ' || c == '\t';
+}
+
+// Parse a header line of the given type ("*3\r\n", "$5\r\n"). 1 on success,
+// 0 if the line is incomplete, and -1 if it's malformed or its value is
+// larger than any we accept. A value of -1 (a null) is returned as such.
+static int
+resp_header(const respparser *rp,const char *buf,size_t avail,char type,
+				long long *val,size_t *hlen){
+	size_t lim = avail < RESP_MAXLINE ? avail : RESP_MAXLINE;
+	size_t lf,z = 1;
+	long long v = 0;
+
+	if(avail == 0){
+		return 0;
+	}
+	if(buf[0] != type){
+		return -1;
+	}
+	if((lf = rp->scanfxn(buf,lim,'\n')) == lim){
+		return lim == avail ? 0 : -1;
+	}
+	if(lf < 3 || buf[lf - 1] != '\r'){
+		return -1;
+	}
+	if(buf[1] == '-'){
+		if(lf != 4 || buf[2] != '1'){
+			return -1;
+		}
+		*val = -1;
+		*hlen = lf + 1;
+		return 1;
+	}
+	for( ; z < lf - 1 ; ++z){
+		if(buf[z] < '0' || buf[z] > '9'){
+			return -1;
+		}
+		if((v = v * 10 + (buf[z] - '0')) > RESP_MAXBULK){
+			return -1;
+		}
+	}
+	*val = v;
+	*hlen = lf + 1;
+	return 1;
+}
+
+// An array of bulk strings. An empty (or null) array is a command without
+// arguments, and is skipped. Should the command's length be learned without
+// it being complete, it's stored to *need.
+static int
+resp_multibulk(const respparser *rp,const char *buf,size_t avail,
+			torque_respstr *argv,size_t maxargs,size_t *argc,
+			size_t *cmdlen,size_t *need){
+	long long n,len;
+	size_t off,hl,z;
+	int r;
+
+	if((r = resp_header(rp,buf,avail,'*',&n,&off)) <= 0){
+		return r;
+	}
+	if(n <= 0){
+		*argc = 0;
+		*cmdlen = off;
+		return 1;
+	}
+	if(n > RESP_MAXARGC){
+		return -1;
+	}
+	*argc = n;
+	if(argv && *argc > maxargs){
+		return RESP_TOOMANY;
+	}
+	for(z = 0 ; z < *argc ; ++z){
+		if((r = resp_header(rp,buf + off,avail - off,'$',&len,&hl)) <= 0){
+			return r;
+		}
+		if(len < 0){
+			return -1;
+		}
+		off += hl;
+		if(avail - off < (size_t)len + 2){
+			*need = off + len + 2;
+			return 0;
+		}
+		if(buf[off + len] != '\r' || buf[off + len + 1] != '\n'){
+			return -1;
+		}
+		if(argv){
+			argv[z].str = buf + off;
+			argv[z].len = len;
+		}
+		off += len + 2;
+	}
+	*cmdlen = off;
+	return 1;
+}
+
+// Inline commands (as typed into telnet(1)) are a line of arguments separated
+// by spaces or tabs. Quoting isn't supported. A blank line is skipped.
+static int
+resp_inline(const respparser *rp,const char *buf,size_t avail,
+			torque_respstr *argv,size_t maxargs,size_t *argc,
+			size_t *cmdlen){
+	size_t lim = avail < RESP_MAXINLINE ? avail : RESP_MAXINLINE;
+	size_t lf,end,z,n = 0;
+
+	if((lf = rp->scanfxn(buf,lim,'\n')) == lim){
+		return lim == avail ? 0 : -1;
+	}
+	end = lf && buf[lf - 1] == '\r' ? lf - 1 : lf;
+	for(z = 0 ; z < end ; ++n){
+		size_t start;
+
+		while(z < end && resp_space(buf[z])){
+			++z;
+		}
+		if(z == end){
+			break;
+		}
+		start = z;
+		while(z < end && !resp_space(buf[z])){
+			++z;
+		}
+		if(argv && n < maxargs){
+			argv[n].str = buf + start;
+			argv[n].len = z - start;
+		}
+	}
+	*argc = n;
+	*cmdlen = lf + 1;
+	return argv && n > maxargs ? RESP_TOOMANY : 1;
+}
+
+// Parse the command at the start of the input into argv, which has room for
+// maxargs arguments. Without argv, the command is only checked for
+// completeness. 1 if it's complete, 0 if more input is required, -1 if it's
+// malformed, and RESP_TOOMANY (setting *argc) should argv be too small.
+static int
+resp_command(const respparser *rp,const char *buf,size_t avail,
+			torque_respstr *argv,size_t maxargs,size_t *argc,
+			size_t *cmdlen,size_t *need){
+	if(buf[0] == '*'){
+		return resp_multibulk(rp,buf,avail,argv,maxargs,argc,cmdlen,need);
+	}
+	return resp_inline(rp,buf,avail,argv,maxargs,argc,cmdlen);
+}
+
+// Hand the batch to the callback, and release its input (len bytes, which
+// include any empty commands skipped along the way) once it returns.
+static int
+resp_dispatch(int fd,torque_rxbuf *rxb,respparser *rp,
+		const torque_respcmd *cmds,unsigned n,size_t len){
+	evhandler *evh;
+	int cb;
+
+	if(n){
+		if( (evh = get_thread_evh()) ){
+			++evh->stats.respbatches;
+			evh->stats.respcmds += n;
+		}
+		if( (cb = rp->cmdfxn(fd,rxb,cmds,n,rp->cbstate)) ){
+			return cb;
+		}
+	}
+	rxbuffer_advance(rxb,len);
+	return 0;
+}
+
+static int
+resp_fail(int fd,torque_rxbuf *rxb,respparser *rp){
+	rp->failed = 1;
+	rxbuffer_advance(rxb,rxb->bufoff - rxb->bufate);
+	shutdown(fd,SHUT_RD);
+	return rp->cmdfxn(fd,rxb,NULL,0,rp->cbstate);
+}
+
+// A complete command with more arguments than a batch holds is dispatched
+// alone, its arguments being described in allocated memory. Failure to
+// allocate is treated as a malformed command.
+static int
+resp_large(int fd,torque_rxbuf *rxb,respparser *rp,size_t argc){
+	const char *buf = rxb->buffer + rxb->bufate;
+	size_t valid = rxb->bufoff - rxb->bufate,cmdlen,need;
+	torque_respcmd cmd;
+	torque_respstr *argv;
+	int cb;
+
+	if((argv = malloc(sizeof(*argv) * argc)) == NULL){
+		return resp_fail(fd,rxb,rp);
+	}
+	resp_command(rp,buf,valid,argv,argc,&argc,&cmdlen,&need);
+	cmd.argc = argc;
+	cmd.argv = argv;
+	cb = resp_dispatch(fd,rxb,rp,&cmd,1,cmdlen);
+	free(argv);
+	return cb;
+}
+
+// Every complete command of the input is parsed in one pass, and handed to
+// the callback in batches of up to RESP_BATCH commands, their arguments
+// described on our stack. Replies queued by the callback are thus gathered
+// into a single writev(2) once the input's exhausted (see buffered_rearm()),
+// rather than being written one per command. Once input has ended
+// (buffered_rxfxn() marks rxdone before calling us), whatever remains is a
+// partial command.
+int resp_rxfxn(int fd,torque_rxbuf *rxb,void *v){
+	torque_rxbufcb *cbctx = v;
+	respparser *rp = cbctx->rxproto;
+	torque_respstr args[RESP_ARGS];
+	torque_respcmd cmds[RESP_BATCH];
+	size_t off = 0,used = 0;
+	unsigned n = 0;
+	int cb;
+
+	if(rp->failed){
+		rxbuffer_advance(rxb,rxb->bufoff - rxb->bufate);
+		return 0;
+	}
+	for( ; ; ){
+		const char *buf = rxb->buffer + rxb->bufate;
+		size_t valid = rxb->bufoff - rxb->bufate,argc,cmdlen,need = 0;
+		int r;
+
+		if(valid - off == 0 || valid - off < rp->need){
+			break;
+		}
+		r = resp_command(rp,buf + off,valid - off,args + used,
+				RESP_ARGS - used,&argc,&cmdlen,&need);
+		if(r == 0){
+			rp->need = need;
+			break;
+		}
+		rp->need = 0;
+		if(r == 1){
+			if(argc){
+				cmds[n].argc = argc;
+				cmds[n].argv = args + used;
+				used += argc;
+				++n;
+			}
+			off += cmdlen;
+			if(n < RESP_BATCH){
+				continue;
+			}
+		}
+		// The batch is full, or the next command must be handled on its
+		// own: dispatch what we have, and look at it again.
+		if(off){
+			if( (cb = resp_dispatch(fd,rxb,rp,cmds,n,off)) ){
+				return cb;
+			}
+			off = used = 0;
+			n = 0;
+			continue;
+		}
+		if(r == RESP_TOOMANY){
+			r = resp_command(rp,buf,valid,NULL,0,&argc,&cmdlen,&need);
+			if(r == 0){
+				rp->need = need;
+				break;
+			}else if(r > 0){
+				if( (cb = resp_large(fd,rxb,rp,argc)) ){
+					return cb;
+				}
+				continue;
+			}
+		}
+		return resp_fail(fd,rxb,rp);
+	}
+	if( (cb = resp_dispatch(fd,rxb,rp,cmds,n,off)) ){
+		return cb;
+	}
+	if(cbctx->rxdone){
+		rxbuffer_advance(rxb,rxb->bufoff - rxb->bufate);
+		return rp->cmdfxn(fd,rxb,NULL,0,rp->cbstate);
+	}
+	return 0;
+}
+
+// Replies are queued a piece at a time; torque_txcopy() coalesces them.
+static torque_err
+resp_line(torque_txbuf *txb,char type,const char *s,size_t len){
+	torque_err ret;
+
+	if(memchr(s,'\r',len) || memchr(s,'\n',len)){
+		return TORQUE_ERR_INVAL;
+	}
+	if((ret = torque_txcopy(txb,&type,1)) == 0){
+		if((ret = torque_txcopy(txb,s,len)) == 0){
+			ret = torque_txcopy(txb,"\r\n",2);
+		}
+	}
+	return ret;
+}
+
+static torque_err
+resp_number(torque_txbuf *txb,char type,long long val){
+	char buf[RESP_MAXLINE];
+	int len;
+
+	len = snprintf(buf,sizeof(buf),"%c%lld\r\n",type,val);
+	return torque_txcopy(txb,buf,len);
+}
+
+torque_err torque_resp_simple(torque_txbuf *txb,const char *s,size_t len){
+	return resp_line(txb,'+',s,len);
+}
+
+torque_err torque_resp_error(torque_txbuf *txb,const char *s,size_t len){
+	return resp_line(txb,'-',s,len);
+}
+
+torque_err torque_resp_integer(torque_txbuf *txb,long long val){
+	return resp_number(txb,':',val);
+}
+
+torque_err torque_resp_bulk(torque_txbuf *txb,const void *data,size_t len){
+	torque_err ret;
+
+	if((ret = resp_number(txb,'$',(long long)len)) == 0){
+		if((ret = torque_txcopy(txb,data,len)) == 0){
+			ret = torque_txcopy(txb,"\r\n",2);
+		}
+	}
+	return ret;
+}
+
+torque_err torque_resp_null(torque_txbuf *txb){
+	return torque_txcopy(txb,"$-1\r\n",5);
+}
+
+torque_err torque_resp_array(torque_txbuf *txb,long long count){
+	if(count < -1){
+		return TORQUE_ERR_INVAL;
+	}
+	return resp_number(txb,'*',count);
+}
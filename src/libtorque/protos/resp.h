@@ -0,0 +1,46 @@
+#ifndef LIBTORQUE_PROTOS_RESP
+#define LIBTORQUE_PROTOS_RESP
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <libtorque/frame.h>
+#include <libtorque/torque.h>
+
+#define RESP_BATCH	64u		// commands dispatched together
+#define RESP_ARGS	1024u		// arguments of a batch (see resp_rxfxn())
+#define RESP_MAXARGC	(1024u * 1024)	// arguments of a command
+#define RESP_MAXBULK	(512u << 20)	// bulk string length
+#define RESP_MAXINLINE	(64u << 10)	// inline command length
+#define RESP_MAXLINE	32u		// array and bulk string headers
+
+// A connection's parser. Commands are parsed anew from their start upon each
+// event, the arguments' headers being cheap to parse and their contents
+// skipped over; the length of the pending command is remembered once known
+// (ie, once the header of a partially-arrived argument has been read), so
+// that a large argument arriving piecemeal isn't reparsed with each read.
+typedef struct respparser {
+	libtorquerespcb cmdfxn;
+	void *cbstate;			// userspace callback state
+	framescanfxn scanfxn;		// see pick_scanfxn()
+	size_t need;			// pending command's length, if known
+	int failed;			// malformed command; input is discarded
+} respparser;
+
+respparser *create_respparser(const struct torque_ctx *,libtorquerespcb,void *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2)))
+	__attribute__ ((malloc));
+
+// The buffered read callback of RESP connections (see buffered_rxfxn()),
+// delivering the complete commands of each read in batches.
+int resp_rxfxn(int,struct torque_rxbuf *,void *)
+	__attribute__ ((nonnull(2,3)));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
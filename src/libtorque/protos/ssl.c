@@ -12,7 +12,9 @@
 #include <openssl/crypto.h>
 #include <libtorque/buffers.h>
 #include <libtorque/schedule.h>
+#include <libtorque/timeouts.h>
 #include <libtorque/protos/ssl.h>
+#include <libtorque/events/evq.h>
 #include <libtorque/events/thread.h>
 
 static unsigned numlocks;
@@ -29,6 +31,9 @@ typedef struct ssl_cbstate {
 	libtorquebrcb rxfxn;
 	libtorquebwcb txfxn;
 	torque_rxbuf rxb;
+	conn_timeouts to;		// a connection's timeouts
+	int timed;			// a listener's connections get timeouts...
+	torque_timeouts tospec;		// ...as specified here
 } ssl_cbstate;
 
 struct ssl_cbstate *
@@ -43,6 +48,8 @@ create_ssl_cbstate(struct torque_ctx *ctx,SSL_CTX *sslctx,void *cbstate,
 			ret->rxfxn = rx;
 			ret->txfxn = tx;
 			ret->ssl = NULL;
+			ret->to.timer = NULL;
+			ret->timed = 0;
 			return ret;
 		}
 		free(ret);
@@ -50,8 +57,17 @@ create_ssl_cbstate(struct torque_ctx *ctx,SSL_CTX *sslctx,void *cbstate,
 	return NULL;
 }
 
+void ssl_set_timeouts(ssl_cbstate *sc,const torque_timeouts *tos){
+	sc->tospec = *tos;
+	if(sc->txfxn == NULL){
+		memset(&sc->tospec.txidle,0,sizeof(sc->tospec.txidle));
+	}
+	sc->timed = 1;
+}
+
 void free_ssl_cbstate(ssl_cbstate *sc){
 	if(sc){
+		release_timeouts(&sc->to);
 		SSL_free(sc->ssl);
 		free_rxbuffer(&sc->rxb);
 		free(sc);
@@ -246,6 +262,25 @@ SSL *new_ssl_conn(SSL_CTX *ctx){
 
 static void ssl_rxfxn(int,void *);
 
+// Connections with timeouts bracket their callbacks, exiting before the fd is
+// rearmed (see timeouts.h). A connection found to have timed out is torn down.
+static inline int
+ssl_enter(int fd,ssl_cbstate *sc,int ev){
+	if(timeouts_enter(&sc->to,ev)){
+		expire_timeouts(&sc->to);
+		free_ssl_cbstate(sc);
+		close(fd);
+		return -1;
+	}
+	return 0;
+}
+
+static inline int
+ssl_restorefd(int fd,ssl_cbstate *sc,int flags){
+	timeouts_exit(&sc->to);
+	return restorefd(get_thread_evh(),fd,flags);
+}
+
 int ssl_tx(int fd,ssl_cbstate *ssl,const void *buf,int len){
 	int ret = 0;
 
@@ -283,6 +318,9 @@ ssl_txrxfxn(int fd,void *cbs){
 	ssl_cbstate *sc = cbs;
 	int r,err;
 
+	if(ssl_enter(fd,sc,EVREAD | EVWRITE)){
+		return;
+	}
 	while((r = rxbuffer_ssl(&sc->rxb,sc->ssl)) > 0){
 		if(sc->rxfxn(fd,&sc->rxb,sc)){
 			goto err;
@@ -294,11 +332,11 @@ ssl_txrxfxn(int fd,void *cbs){
 
 		set_evsource_rx(ctx->eventtables.fdarray,fd,ssl_rxfxn);
 		set_evsource_tx(ctx->eventtables.fdarray,fd,NULL);
-		if(restorefd(get_thread_evh(),fd,EVREAD)){
+		if(ssl_restorefd(fd,sc,EVREAD)){
 			goto err;
 		}
 	}else if(err == SSL_ERROR_WANT_WRITE){
-		if(restorefd(get_thread_evh(),fd,EVREAD|EVWRITE)){ // just let it loop
+		if(ssl_restorefd(fd,sc,EVREAD|EVWRITE)){ // just let it loop
 			goto err;
 		}
 	}else{
@@ -317,6 +355,9 @@ ssl_rxfxn(int fd,void *cbstate){
 	ssl_cbstate *sc = cbstate;
 	int r,err;
 
+	if(ssl_enter(fd,sc,EVREAD)){
+		return;
+	}
 	while((r = rxbuffer_ssl(&sc->rxb,sc->ssl)) >= 0){
 		if(sc->rxfxn(fd,&sc->rxb,sc)){
 			goto err;
@@ -328,11 +369,11 @@ ssl_rxfxn(int fd,void *cbstate){
 
 		set_evsource_rx(ctx->eventtables.fdarray,fd,NULL);
 		set_evsource_tx(ctx->eventtables.fdarray,fd,ssl_txrxfxn);
-		if(restorefd(get_thread_evh(),fd,EVWRITE|EVREAD)){
+		if(ssl_restorefd(fd,sc,EVWRITE|EVREAD)){
 			goto err;
 		}
 	}else if(err == SSL_ERROR_WANT_READ){
-		if(restorefd(get_thread_evh(),fd,EVREAD)){ // just let it loop
+		if(ssl_restorefd(fd,sc,EVREAD)){ // just let it loop
 			goto err;
 		}
 	}else{
@@ -350,6 +391,9 @@ static void
 ssl_txfxn(int fd,void *cbs){
 	ssl_cbstate *sc = cbs;
 
+	if(ssl_enter(fd,sc,EVWRITE)){
+		return;
+	}
 	if(sc->txfxn == NULL){
 		free_ssl_cbstate(sc);
 		close(fd);
@@ -357,6 +401,7 @@ ssl_txfxn(int fd,void *cbs){
 		if(sc->txfxn(fd,&sc->rxb,sc)){
 			goto err;
 		}
+		timeouts_exit(&sc->to);
 	}
 	return;
 
@@ -371,10 +416,12 @@ static void accept_conttxfxn(int,void *);
 static void
 accept_contrxfxn(int fd,void *cbstate){
 	torque_ctx *ctx = get_thread_ctx();
-	evhandler *evh = get_thread_evh();
 	ssl_cbstate *sc = cbstate;
 	int ret;
 
+	if(ssl_enter(fd,sc,EVREAD)){
+		return;
+	}
 	if((ret = SSL_accept(sc->ssl)) == 1){
 		libtorquercb rx = sc->rxfxn ? ssl_rxfxn : NULL;
 		libtorquewcb tx = sc->txfxn ? ssl_txfxn : NULL;
@@ -384,7 +431,7 @@ accept_contrxfxn(int fd,void *cbstate){
 		}
 		set_evsource_rx(ctx->eventtables.fdarray,fd,rx);
 		set_evsource_tx(ctx->eventtables.fdarray,fd,tx);
-		if(restorefd(evh,fd,(rx ? EVREAD : 0) | (tx ? EVWRITE : 0))){
+		if(ssl_restorefd(fd,sc,(rx ? EVREAD : 0) | (tx ? EVWRITE : 0))){
 			goto err;
 		}
 	}else{
@@ -393,11 +440,11 @@ accept_contrxfxn(int fd,void *cbstate){
 		if(err == SSL_ERROR_WANT_WRITE){
 			set_evsource_rx(ctx->eventtables.fdarray,fd,NULL);
 			set_evsource_tx(ctx->eventtables.fdarray,fd,accept_conttxfxn);
-			if(restorefd(evh,fd,EVWRITE)){
+			if(ssl_restorefd(fd,sc,EVWRITE)){
 				goto err;
 			}
 		}else if(err == SSL_ERROR_WANT_READ){
-			if(restorefd(evh,fd,EVREAD)){ // just let it loop
+			if(ssl_restorefd(fd,sc,EVREAD)){ // just let it loop
 				goto err;
 			}
 		}else{
@@ -417,6 +464,9 @@ accept_conttxfxn(int fd,void *cbs){
 	ssl_cbstate *sc = cbs;
 	int ret;
 
+	if(ssl_enter(fd,sc,EVWRITE)){
+		return;
+	}
 	if((ret = SSL_accept(sc->ssl)) == 1){
 		libtorquercb rx = sc->rxfxn ? ssl_rxfxn : NULL;
 		libtorquewcb tx = sc->txfxn ? ssl_txfxn : NULL;
@@ -438,6 +488,7 @@ accept_conttxfxn(int fd,void *cbs){
 			goto err;
 		}
 	}
+	timeouts_exit(&sc->to);
 	return;
 
 err:
@@ -463,6 +514,11 @@ ssl_accept_internal(int sd,const ssl_cbstate *sc){
 		free_ssl_cbstate(csc);
 		return -1;
 	}
+	if(sc->timed && init_timeouts(ctx,local_evqueue(ctx),&csc->to,sd,
+					&sc->tospec,sc->cbstate)){
+		free_ssl_cbstate(csc);
+		return -1;
+	}
 	if((ret = SSL_accept(csc->ssl)) == 1){
 		libtorquercb rx = sc->rxfxn ? ssl_rxfxn : NULL;
 		libtorquewcb tx = sc->txfxn ? ssl_txfxn : NULL;
@@ -503,10 +559,16 @@ void ssl_accept_rxfxn(int fd,void *cbstate){
 	int sd;
 
 	do{
+#ifndef SOCK_NONBLOCK
 		int flags;
+#endif
 
 		slen = sizeof(sina);
+#ifdef SOCK_NONBLOCK
+		while((sd = accept4(fd,&sina,&slen,SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0){
+#else
 		while((sd = accept(fd,&sina,&slen)) < 0){
+#endif
 			if(errno != EINTR){ // loop on EINTR
 				if(restorefd(get_thread_evh(),fd,EVREAD)){
 					// FIXME stat?;
@@ -514,9 +576,12 @@ void ssl_accept_rxfxn(int fd,void *cbstate){
 				return;
 			}
 		}
+#ifndef SOCK_NONBLOCK
 		if(((flags = fcntl(sd,F_GETFL)) < 0) || fcntl(sd,F_SETFL,flags | O_NONBLOCK)){
 			close(sd);
-		}else if(ssl_accept_internal(sd,cbstate)){
+		}else
+#endif
+		if(ssl_accept_internal(sd,cbstate)){
 			close(sd);
 		}
 	}while(1);
@@ -24,6 +24,10 @@ create_ssl_cbstate(struct torque_ctx *,SSL_CTX *,void *,libtorquebrcb,libtorqueb
 
 void free_ssl_cbstate(struct ssl_cbstate *);
 
+// Subject connections accepted by this listener's state to timeouts.
+void ssl_set_timeouts(struct ssl_cbstate *,const torque_timeouts *)
+	__attribute__ ((nonnull(1,2)));
+
 void ssl_accept_rxfxn(int,void *) __attribute__ ((nonnull(2)));
 
 #ifdef __cplusplus
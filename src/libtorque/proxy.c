@@ -0,0 +1,193 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <libtorque/proxy.h>
+#include <libtorque/events/sysdep.h>
+#include <libtorque/events/thread.h>
+#include <libtorque/events/sources.h>
+
+#ifdef TORQUE_LINUX
+#define PROXY_PIPESZ	65536		// should F_GETPIPE_SZ be unavailable
+
+static int
+init_proxydir(proxydir *d,int src,int dst){
+	int sz;
+
+	if(pipe2(d->pipe,O_NONBLOCK | O_CLOEXEC)){
+		return -1;
+	}
+	d->pipesz = PROXY_PIPESZ;
+#ifdef F_GETPIPE_SZ
+	if((sz = fcntl(d->pipe[1],F_GETPIPE_SZ)) > 0){
+		d->pipesz = sz;
+	}
+#else
+	(void)sz;
+#endif
+	d->src = src;
+	d->dst = dst;
+	d->inpipe = 0;
+	d->bytes = 0;
+	d->eof = d->shut = 0;
+	return 0;
+}
+
+static int
+watch_proxied(int epfd,int sd){
+	struct epoll_event ev;
+	int flags;
+
+	if((flags = fcntl(sd,F_GETFL)) < 0 || fcntl(sd,F_SETFL,flags | O_NONBLOCK)){
+		return -1;
+	}
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.fd = sd;
+	return epoll_ctl(epfd,EPOLL_CTL_ADD,sd,&ev);
+}
+
+torque_proxy *create_proxy(int sa,int sb,libtorqueproxycb donefxn,void *state){
+	torque_proxy *ret;
+
+	if((ret = malloc(sizeof(*ret))) == NULL){
+		return NULL;
+	}
+	if(init_proxydir(&ret->dirs[0],sa,sb)){
+		goto err;
+	}
+	if(init_proxydir(&ret->dirs[1],sb,sa)){
+		goto pipe0err;
+	}
+	if((ret->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0){
+		goto pipe1err;
+	}
+	if(watch_proxied(ret->epfd,sa) || watch_proxied(ret->epfd,sb)){
+		close(ret->epfd);
+		goto pipe1err;
+	}
+	ret->donefxn = donefxn;
+	ret->cbstate = state;
+	return ret;
+
+pipe1err:
+	close(ret->dirs[1].pipe[0]);
+	close(ret->dirs[1].pipe[1]);
+pipe0err:
+	close(ret->dirs[0].pipe[0]);
+	close(ret->dirs[0].pipe[1]);
+err:
+	free(ret);
+	return NULL;
+}
+
+// splice(2) into the pipe fails with EAGAIN whether the socket is empty or
+// the pipe is full (which can happen short of pipesz, the pipe's capacity
+// being in pages). Either way, we'll be back: once draining the pipe makes
+// progress, we loop around to read again, and otherwise the socket's next
+// edge brings us back. Returns -1 with errno set on a fatal error.
+static int
+proxy_pump(proxydir *d){
+	const unsigned flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+	ssize_t r;
+	int moved;
+
+	do{
+		moved = 0;
+		if(!d->eof && d->inpipe < d->pipesz){
+			if((r = splice(d->src,NULL,d->pipe[1],NULL,d->pipesz - d->inpipe,flags)) > 0){
+				d->inpipe += r;
+				moved = 1;
+			}else if(r == 0){
+				d->eof = 1;
+			}else if(errno == EINTR){
+				moved = 1;
+			}else if(errno != EAGAIN){
+				return -1;
+			}
+		}
+		if(d->inpipe){
+			if((r = splice(d->pipe[0],NULL,d->dst,NULL,d->inpipe,flags)) > 0){
+				d->inpipe -= r;
+				d->bytes += r;
+				moved = 1;
+			}else if(r < 0 && errno == EINTR){
+				moved = 1;
+			}else if(r < 0 && errno != EAGAIN){
+				return -1;
+			}
+		}
+	}while(moved);
+	// Propagate the half-close once everything read has been written.
+	if(d->eof && d->inpipe == 0 && !d->shut){
+		if(shutdown(d->dst,SHUT_WR) && errno != ENOTCONN){
+			return -1;
+		}
+		d->shut = 1;
+	}
+	return 0;
+}
+
+void free_proxy(torque_proxy *p){
+	if(p){
+		close(p->epfd);
+		close(p->dirs[1].pipe[0]);
+		close(p->dirs[1].pipe[1]);
+		close(p->dirs[0].pipe[0]);
+		close(p->dirs[0].pipe[1]);
+		free(p);
+	}
+}
+
+static void
+proxy_done(torque_proxy *p,int err){
+	const int sa = p->dirs[0].src,sb = p->dirs[1].src;
+
+	setup_evsource(get_thread_ctx()->eventtables.fdarray,p->epfd,NULL,NULL,NULL);
+	if(p->donefxn){
+		p->donefxn(sa,sb,p->dirs[0].bytes,p->dirs[1].bytes,err,p->cbstate);
+	}
+	free_proxy(p);
+	close(sa);
+	close(sb);
+}
+
+// Readiness on either socket is only a hint; both directions are pumped. The
+// epoll set's ready list must be emptied, lest the rearm fire immediately.
+// Edges arriving while we pump are queued anew, and wake us once rearmed.
+void proxy_rxfxn(int fd,void *cbstate){
+	struct epoll_event evs[2];
+	torque_proxy *p = cbstate;
+	int err = 0;
+
+	while(epoll_wait(fd,evs,sizeof(evs) / sizeof(*evs),0) < 0 && errno == EINTR){
+		;
+	}
+	if(proxy_pump(&p->dirs[0]) || proxy_pump(&p->dirs[1])){
+		err = errno;
+	}else if(!p->dirs[0].shut || !p->dirs[1].shut){
+		if(restorefd(get_thread_evh(),fd,EVREAD) == 0){
+			return;
+		}
+		err = errno;
+	}
+	proxy_done(p,err);
+}
+#else
+torque_proxy *create_proxy(int sa __attribute__ ((unused)),
+			int sb __attribute__ ((unused)),
+			libtorqueproxycb donefxn __attribute__ ((unused)),
+			void *state __attribute__ ((unused))){
+	errno = ENOSYS;
+	return NULL;
+}
+
+void proxy_rxfxn(int fd __attribute__ ((unused)),void *cbstate __attribute__ ((unused))){
+}
+
+void free_proxy(torque_proxy *p){
+	free(p);
+}
+#endif
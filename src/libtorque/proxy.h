@@ -0,0 +1,41 @@
+#ifndef TORQUE_PROXY
+#define TORQUE_PROXY
+
+#include <stdint.h>
+#include <libtorque/torque.h>
+
+// One direction of a proxy: bytes are spliced from src into the pipe, and
+// from the pipe into dst, never entering userspace. inpipe tracks the pipe's
+// occupancy, so that we stop reading from src once it's full.
+typedef struct proxydir {
+	int src,dst;
+	int pipe[2];			// read end, write end
+	size_t inpipe,pipesz;
+	uint64_t bytes;			// written to dst
+	int eof;			// src has been read to completion
+	int shut;			// ...and dst shut down for writing
+} proxydir;
+
+// The two sockets are watched edge-triggered through a private epoll set,
+// itself registered one-shot with the evqueue. Events on either socket thus
+// run the same handler, never in more than one thread at a time, which can
+// safely tear down both (see proxy_rxfxn()).
+typedef struct torque_proxy {
+	proxydir dirs[2];		// first to second, second to first
+	libtorqueproxycb donefxn;
+	void *cbstate;			// userspace callback state
+	int epfd;			// epoll set holding both sockets
+} torque_proxy;
+
+torque_proxy *create_proxy(int,int,libtorqueproxycb,void *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((malloc));
+
+// Pump both directions, as far as they'll go, tearing down the proxy once
+// both have finished or either has failed.
+void proxy_rxfxn(int,void *);
+
+// Closes only the pipes and epoll set; the sockets are the caller's.
+void free_proxy(torque_proxy *);
+
+#endif
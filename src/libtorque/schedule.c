@@ -103,6 +103,7 @@ reap_thread(pthread_t tid){
 
 typedef struct tguard {
 	torque_ctx *ctx;
+	const evqueue *evq;
 	pthread_mutex_t lock;
 	pthread_cond_t cond;
 	stack_t stack;
@@ -125,7 +126,7 @@ thread(void *void_marshal){
 	if(pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,NULL)){
 		goto earlyerr;
 	}
-	if((ev = create_evhandler(&ctx->evq,&marshal->stack)) == NULL){
+	if((ev = create_evhandler(ctx,marshal->evq,&marshal->stack)) == NULL){
 		goto earlyerr;
 	}
 	if(pthread_mutex_lock(&marshal->lock)){
@@ -176,10 +177,12 @@ int setup_thread_stack(stack_t *s,pthread_attr_t *attr){
 }
 
 // Must be pinned to the desired CPU upon entry! // FIXME verify?
-int spawn_thread(torque_ctx *ctx){
+// The new thread will wait on the specified evqueue.
+int spawn_thread(torque_ctx *ctx,const evqueue *evq){
 	pthread_attr_t attr;
 	tguard tidguard = {
 		.ctx = ctx,
+		.evq = evq,
 	};
 	pthread_t tid;
 	int ret = 0;
@@ -31,10 +31,11 @@ portable_cpuset_count(const cpu_set_t *mask){
 	return count;
 }
 
+struct evqueue;
 struct torque_ctx;
 
 int pin_thread(unsigned);
-int spawn_thread(struct torque_ctx *);
+int spawn_thread(struct torque_ctx *,const struct evqueue *);
 int reap_threads(struct torque_ctx *);
 int block_threads(struct torque_ctx *);
 int get_thread_aid(void);
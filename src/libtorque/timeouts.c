@@ -0,0 +1,182 @@
+#include <string.h>
+#include <sys/socket.h>
+#include <libtorque/timeouts.h>
+#include <libtorque/events/timer.h>
+#include <libtorque/events/thread.h>
+#include <libtorque/events/sources.h>
+
+// The connection's earliest deadline, and which timeout it belongs to. Call
+// with the lock held.
+static uint64_t
+next_timeout(const conn_timeouts *to,torque_timeout *why){
+	uint64_t next = UINT64_MAX;
+
+	if(to->rxidle && to->rxstamp + to->rxidle < next){
+		next = to->rxstamp + to->rxidle;
+		*why = TORQUE_TIMEOUT_RXIDLE;
+	}
+	if(to->txidle && to->txstamp + to->txidle < next){
+		next = to->txstamp + to->txidle;
+		*why = TORQUE_TIMEOUT_TXIDLE;
+	}
+	if(to->deadline && to->deadline < next){
+		next = to->deadline;
+		*why = TORQUE_TIMEOUT_LIFETIME;
+	}
+	return next;
+}
+
+// Timeouts needn't be precise, and a busy server has many of them. Allowing
+// each to run 1/16th late lets those of similar deadlines share wakeups.
+static uint64_t
+timeouts_slack(const conn_timeouts *to){
+	uint64_t min = UINT64_MAX;
+
+	if(to->rxidle && to->rxidle < min){
+		min = to->rxidle;
+	}
+	if(to->txidle && to->txidle < min){
+		min = to->txidle;
+	}
+	if(to->deadline && to->deadline - to->rxstamp < min){
+		min = to->deadline - to->rxstamp;
+	}
+	return min == UINT64_MAX ? 0 : min >> 4;
+}
+
+static int
+arm_timeouts(conn_timeouts *to,uint64_t when){
+	struct itimerspec its;
+
+	memset(&its,0,sizeof(its));
+	its.it_value.tv_sec = when / 1000000000ull;
+	its.it_value.tv_nsec = when % 1000000000ull;
+	return mod_timer(to->timer,TORQUE_TIMER_ABSTIME,&its) ? -1 : 0;
+}
+
+static void
+timeouts_timercb(void *state){
+	conn_timeouts *to = state;
+	uint64_t now = monotonic_ns(),next;
+	torque_timeout why = TORQUE_TIMEOUT_LIFETIME;
+
+	pthread_mutex_lock(&to->lock);
+	if(!to->expired){
+		if((next = next_timeout(to,&why)) > now){
+			// Events pushed the deadline back. Should we fail to rearm,
+			// time out now rather than never.
+			if(arm_timeouts(to,next) == 0){
+				pthread_mutex_unlock(&to->lock);
+				return;
+			}
+		}
+		to->why = why;
+		to->expired = 1;
+		if(to->busy == 0){
+			shutdown(to->fd,SHUT_RDWR);
+		}
+	}
+	pthread_mutex_unlock(&to->lock);
+}
+
+torque_err init_timeouts(torque_ctx *ctx,const evqueue *evq,conn_timeouts *to,
+			int fd,const torque_timeouts *spec,void *cbstate){
+	torque_timeout why;
+	uint64_t now,next;
+	struct itimerspec its;
+	torque_err ret;
+
+	to->timer = NULL;
+	if(spec == NULL){
+		return 0;
+	}
+	if(!valid_timespec(&spec->rxidle) || !valid_timespec(&spec->txidle) ||
+			!valid_timespec(&spec->lifetime)){
+		return TORQUE_ERR_INVAL;
+	}
+	now = torque_now();
+	to->rxidle = timespec_ns(&spec->rxidle);
+	to->txidle = timespec_ns(&spec->txidle);
+	to->deadline = timespec_ns(&spec->lifetime);
+	if(to->deadline){
+		to->deadline += now;
+	}
+	to->rxstamp = to->txstamp = now;
+	if((next = next_timeout(to,&why)) == UINT64_MAX){
+		return 0;
+	}
+	to->fd = fd;
+	to->busy = 0;
+	to->expired = 0;
+	to->expirecb = spec->expirecb;
+	to->cbstate = cbstate;
+	if(pthread_mutex_init(&to->lock,NULL)){
+		return TORQUE_ERR_RESOURCE;
+	}
+	memset(&its,0,sizeof(its));
+	its.it_value.tv_sec = next / 1000000000ull;
+	its.it_value.tv_nsec = next % 1000000000ull;
+	if( (ret = add_timer_to_evhandler(ctx,evq,TORQUE_TIMER_ABSTIME,&its,
+				timeouts_slack(to),timeouts_timercb,to,&to->timer)) ){
+		pthread_mutex_destroy(&to->lock);
+		to->timer = NULL;
+		return ret;
+	}
+	return 0;
+}
+
+void release_timeouts(conn_timeouts *to){
+	if(to->timer){
+		del_timer_sync(to->timer);
+		to->timer = NULL;
+		pthread_mutex_destroy(&to->lock);
+	}
+}
+
+int timeouts_enter(conn_timeouts *to,int ev){
+	uint64_t now;
+
+	if(to->timer == NULL){
+		return 0;
+	}
+	now = torque_now();
+	pthread_mutex_lock(&to->lock);
+	if(to->expired){
+		pthread_mutex_unlock(&to->lock);
+		return -1;
+	}
+	++to->busy;
+	if(ev & EVREAD){
+		to->rxstamp = now;
+	}
+	if(ev & EVWRITE){
+		to->txstamp = now;
+	}
+	pthread_mutex_unlock(&to->lock);
+	return 0;
+}
+
+void timeouts_exit(conn_timeouts *to){
+	if(to->timer){
+		pthread_mutex_lock(&to->lock);
+		if(--to->busy == 0 && to->expired){
+			shutdown(to->fd,SHUT_RDWR);
+		}
+		pthread_mutex_unlock(&to->lock);
+	}
+}
+
+void expire_timeouts(conn_timeouts *to){
+	torque_ctx *ctx = get_thread_ctx();
+	evhandler *evh = get_thread_evh();
+
+	release_timeouts(to);
+	set_evsource_rx(ctx->eventtables.fdarray,to->fd,NULL);
+	set_evsource_tx(ctx->eventtables.fdarray,to->fd,NULL);
+	if(evh){
+		++evh->stats.timeouts;
+	}
+	if(to->expirecb){
+		to->expirecb(to->fd,to->why,to->cbstate);
+	}
+}
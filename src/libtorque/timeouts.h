@@ -0,0 +1,73 @@
+#ifndef torque_TIMEOUTS
+#define torque_TIMEOUTS
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+#include <libtorque/internal.h>
+
+struct torque_timer;
+
+// Idle and lifetime timeouts of a buffered connection, sharing a single timer
+// of the evqueue's wheel. Events merely stamp the connection; the timer is
+// left alone, and upon firing either finds the connection timed out, or is
+// pushed back to the earliest remaining deadline.
+//
+// A connection's callbacks are bracketed by timeouts_enter() and
+// timeouts_exit(), the latter being called before the fd is rearmed. Should
+// the timer fire outside of a callback, it shuts down the socket in both
+// directions, waking the connection whatever its registered interest (a
+// hangup is reported even to a connection awaiting only writability, ie one
+// whose peer won't read); if within, the exiting callback does so. Either
+// way, the next callback to enter finds the connection timed out, and tears
+// it down in its stead. The fd is thus only closed from its own callbacks,
+// and only shut down while it can't be closed (the timer being deleted, and
+// waited upon, before any close).
+typedef struct conn_timeouts {
+	struct torque_timer *timer;	// NULL if no timeouts are in effect
+	pthread_mutex_t lock;		// protects the remainder
+	int fd;
+	unsigned busy;			// callbacks executing
+	int expired;			// non-zero once timed out
+	torque_timeout why;		// valid once expired
+	uint64_t rxidle,txidle;		// ns, 0 if unused
+	uint64_t rxstamp,txstamp;	// most recent events (CLOCK_MONOTONIC ns)
+	uint64_t deadline;		// end of lifetime, 0 if unused
+	libtorquetocb expirecb;
+	void *cbstate;			// user state, passed to expirecb
+} conn_timeouts;
+
+// A NULL or all-zero torque_timeouts leaves the connection without timeouts.
+torque_err init_timeouts(struct torque_ctx *,const struct evqueue *,
+			conn_timeouts *,int,const torque_timeouts *,void *)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2,3)));
+
+// Delete the timer, waiting out any running expiry. Call before closing the
+// fd, and never while within timeouts_enter()/timeouts_exit() locks.
+void release_timeouts(conn_timeouts *)
+	__attribute__ ((nonnull(1)));
+
+// Non-zero if the connection has timed out, in which case the caller must
+// invoke expire_timeouts(), release the connection's state, and close the
+// fd, rather than proceed. EVREAD or EVWRITE indicates the event.
+int timeouts_enter(conn_timeouts *,int)
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
+void timeouts_exit(conn_timeouts *)
+	__attribute__ ((nonnull(1)));
+
+// Detach the fd from its callbacks, invoke the user's expiry callback, and
+// release the timeouts. The fd remains open.
+void expire_timeouts(conn_timeouts *)
+	__attribute__ ((nonnull(1)));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -3,13 +3,20 @@
 #include <unistd.h>
 #include <limits.h>
 #include <libtorque/conn.h>
+#include <libtorque/frame.h>
+#include <libtorque/proxy.h>
+#include <libtorque/listen.h>
 #include <libtorque/buffers.h>
 #include <libtorque/internal.h>
 #include <libtorque/events/fd.h>
 #include <libtorque/protos/ssl.h>
 #include <libtorque/protos/dns.h>
+#include <libtorque/protos/http.h>
+#include <libtorque/protos/resp.h>
 #include <libtorque/events/evq.h>
+#include <libtorque/events/uring.h>
 #include <libtorque/events/path.h>
+#include <libtorque/events/post.h>
 #include <libtorque/events/timer.h>
 #include <libtorque/hardware/arch.h>
 #include <libtorque/events/sysdep.h>
@@ -62,6 +69,7 @@ free_etables(evtables *e){
 
 #ifdef TORQUE_LINUX_SIGNALFD
 	ret |= close(e->common_signalfd);
+	ret |= pthread_mutex_destroy(&e->siglock);
 #endif
 	ret |= destroy_evsources(e->sigarray);
 	ret |= destroy_evsources(e->fdarray);
@@ -69,10 +77,34 @@ free_etables(evtables *e){
 }
 
 static inline torque_ctx *
-create_torque_ctx(torque_err *e,const sigset_t *ss){
+create_torque_ctx(torque_err *e,const sigset_t *ss,const torque_opts *opts){
 	torque_ctx *ret;
+	unsigned z;
 
 	if( (ret = malloc(sizeof(*ret))) ){
+		ret->opts = *opts;
+#ifndef TORQUE_LINUX_URING
+		ret->opts.evbackend = TORQUE_BACKEND_NATIVE;
+#endif
+#ifndef TORQUE_LINUX
+		ret->opts.leaderfollower = 0;
+#endif
+		if(ret->opts.evecmax == 0){
+			ret->opts.evecmax = ret->opts.evecmin > TORQUE_EVEC_MAX ?
+				ret->opts.evecmin : TORQUE_EVEC_MAX;
+		}
+		if(ret->opts.evecmin == 0){
+			ret->opts.evecmin = ret->opts.evecmax < TORQUE_EVEC_MIN ?
+				ret->opts.evecmax : TORQUE_EVEC_MIN;
+		}
+		for(z = 0 ; z < TORQUE_PRIO_CLASSES ; ++z){
+			if(ret->opts.lanebudget[z] == 0){
+				ret->opts.lanebudget[z] = z == TORQUE_PRIO_BULK ?
+					TORQUE_LANE_BULK : TORQUE_LANE_UNLIMITED;
+			}
+		}
+		ret->evqcount = 1;
+		ret->evqrr = 0;
 		if(initialize_etables(ret,&ret->eventtables,ss)){
 			free(ret);
 			*e = TORQUE_ERR_RESOURCE;
@@ -90,6 +122,7 @@ create_torque_ctx(torque_err *e,const sigset_t *ss){
 		ret->cpu_typecount = 0;
 		ret->nodecount = 0;
 		ret->ev = NULL;
+		ret->prioritized = 0;
 	}
 	return ret;
 }
@@ -100,16 +133,16 @@ free_torque_ctx(torque_ctx *ctx){
 
 	ret |= free_etables(&ctx->eventtables);
 	free_architecture(ctx);
-	ret |= destroy_evqueue(&ctx->evq);
+	ret |= destroy_evqueues(ctx);
 	free(ctx);
 	return ret;
 }
 
 static torque_ctx *
-torque_init_sigmasked(torque_err *e,const sigset_t *ss){
+torque_init_sigmasked(torque_err *e,const sigset_t *ss,const torque_opts *opts){
 	torque_ctx *ctx;
 
-	if((ctx = create_torque_ctx(e,ss)) == NULL){
+	if((ctx = create_torque_ctx(e,ss,opts)) == NULL){
 		return NULL;
 	}
 	if( (*e = detect_architecture(ctx)) ){
@@ -163,11 +196,31 @@ torque_err torque_sigmask(sigset_t *olds){
 }
 
 torque_ctx *torque_init(torque_err *e){
+	return torque_init_opts(NULL,e);
+}
+
+torque_ctx *torque_init_opts(const torque_opts *opts,torque_err *e){
+	const torque_opts defopts = {
+		.evqmode = TORQUE_EVQ_SHARED,
+		.evbackend = TORQUE_BACKEND_NATIVE,
+	};
 	struct sigaction oldact;
 	torque_ctx *ret;
 	sigset_t old,add;
 
 	*e = TORQUE_ERR_NONE;
+	if(opts == NULL){
+		opts = &defopts;
+	}
+	if(opts->evqmode > TORQUE_EVQ_THREAD || opts->evbackend > TORQUE_BACKEND_URING){
+		*e = TORQUE_ERR_INVAL;
+		return NULL;
+	}
+	if(opts->evecmin > INT_MAX || opts->evecmax > INT_MAX || opts->spinus > INT_MAX ||
+			(opts->evecmax && opts->evecmin > opts->evecmax)){
+		*e = TORQUE_ERR_INVAL;
+		return NULL;
+	}
 	// If SIGPIPE isn't being handled or at least ignored, start ignoring
 	// it (don't blow away a preexisting handler, though).
 	if(sigaction(SIGPIPE,NULL,&oldact)){
@@ -185,7 +238,7 @@ torque_ctx *torque_init(torque_err *e){
 		*e = TORQUE_ERR_ASSERT;
 		return NULL;
 	}
-	ret = torque_init_sigmasked(e,&old);
+	ret = torque_init_sigmasked(e,&old,opts);
 	if(pthread_sigmask(SIG_SETMASK,&old,NULL)){
 		torque_stop(ret);
 		*e = TORQUE_ERR_ASSERT;
@@ -206,54 +259,229 @@ torque_err torque_addsignal(torque_ctx *ctx,const sigset_t *sigs,
 	if(pthread_sigmask(SIG_BLOCK,sigs,&old)){
 		return TORQUE_ERR_ASSERT;
 	}
-	if( (ret = add_signal_to_evhandler(ctx,&ctx->evq,sigs,fxn,state)) ){
+	if( (ret = add_signal_to_evhandler(ctx,local_evqueue(ctx),sigs,fxn,state)) ){
 		pthread_sigmask(SIG_SETMASK,&old,NULL);
 		return ret;
 	}
 	return 0;
 }
 
-torque_err torque_addtimer(torque_ctx *ctx,const struct itimerspec *t,
-			libtorquetimecb fxn,void *state){
-	return add_timer_to_evhandler(ctx,&ctx->evq,t,fxn,state);
+torque_err torque_addtimer(torque_ctx *ctx,int flags,const struct itimerspec *t,
+			const struct timespec *slack,libtorquetimecb fxn,
+			void *state,struct torque_timer **handle){
+	uint64_t ns = 0;
+
+	if(slack){
+		if(!valid_timespec(slack)){
+			return TORQUE_ERR_INVAL;
+		}
+		ns = timespec_ns(slack);
+	}
+	return add_timer_to_evhandler(ctx,local_evqueue(ctx),flags,t,ns,fxn,
+					state,handle);
+}
+
+torque_err torque_post(torque_ctx *ctx,libtorquepostcb fxn,void *arg){
+	return post_task(local_evqueue(ctx)->postq,fxn,arg);
+}
+
+torque_err torque_post_aid(torque_ctx *ctx,unsigned aid,libtorquepostcb fxn,
+				void *arg){
+	const evqueue *e;
+
+	if((e = aid_evqueue(ctx,aid)) == NULL){
+		return TORQUE_ERR_INVAL;
+	}
+	return post_task(e->postq,fxn,arg);
+}
+
+torque_err torque_modtimer(struct torque_timer *timer,int flags,
+				const struct itimerspec *t){
+	return mod_timer(timer,flags,t);
+}
+
+void torque_deltimer(struct torque_timer *timer){
+	del_timer(timer);
 }
 
 // We only currently provide one buffering scheme. When that changes, we still
 // won't want to expose anything more than necessary to applications...
 torque_err torque_addfd(torque_ctx *ctx,int fd,libtorquebrcb rx,
 				libtorquebwcb tx,void *state){
+	return torque_addfd_prio(ctx,fd,rx,tx,state,TORQUE_PRIO_NORMAL);
+}
+
+// Event threads only sort their events into lanes once some source requires
+// it, sparing the default case the cost.
+static inline int
+prioritize(torque_ctx *ctx,torque_prio prio){
+	if((unsigned)prio >= TORQUE_PRIO_CLASSES){
+		return -1;
+	}
+	if(prio != TORQUE_PRIO_NORMAL){
+		ctx->prioritized = 1;
+	}
+	return 0;
+}
+
+// The protocol state, if any, is the connection's once passed (and is freed
+// with it, or upon failure).
+static torque_err
+addfd_buffered(torque_ctx *ctx,int fd,libtorquebrcb rx,libtorquebwcb tx,
+		void *state,torque_prio prio,const torque_timeouts *tos,
+		void *rxproto){
+	const evqueue *evq = local_evqueue(ctx);
 	torque_rxbufcb *cbctx;
 	torque_err ret;
 
-	if(fd < 0){
+	if(fd < 0 || prioritize(ctx,prio)){
+		free(rxproto);
 		return TORQUE_ERR_INVAL;
 	}
-	if((cbctx = create_rxbuffercb(ctx,rx,tx,state)) == NULL){
+	if((cbctx = create_rxbuffercb(ctx,fd,rx,tx,state)) == NULL){
+		free(rxproto);
 		return TORQUE_ERR_RESOURCE;
 	}
-	if( (ret = add_fd_to_evhandler(ctx,&ctx->evq,fd,
-					rx ? buffered_rxfxn : NULL,
-					tx ? buffered_txfxn : NULL,
-					cbctx,EVONESHOT)) ){
+	cbctx->rxproto = rxproto;
+	if( (ret = init_timeouts(ctx,evq,&cbctx->to,fd,tos,state)) ){
 		free_rxbuffercb(cbctx);
+		free(cbctx);
+		return ret;
+	}
+	// Write interest is registered initially only for the write callback;
+	// thereafter, only while output is queued (see buffered_txfxn()).
+	if( (ret = add_fd_to_evhandler_armed(ctx,evq,fd,
+					rx ? buffered_rxfxn : NULL,buffered_txfxn,
+					cbctx,EVONESHOT,prio,tx != NULL)) ){
+		release_timeouts(&cbctx->to);
+		free_rxbuffercb(cbctx);
+		free(cbctx);
 	}
 	return ret;
 }
 
+torque_err torque_addfd_prio(torque_ctx *ctx,int fd,libtorquebrcb rx,
+			libtorquebwcb tx,void *state,torque_prio prio){
+	return addfd_buffered(ctx,fd,rx,tx,state,prio,NULL,NULL);
+}
+
+torque_err torque_addfd_timeouts(torque_ctx *ctx,int fd,libtorquebrcb rx,
+		libtorquebwcb tx,void *state,const torque_timeouts *tos){
+	torque_timeouts t = *tos;
+
+	if(tx == NULL){
+		memset(&t.txidle,0,sizeof(t.txidle));
+	}
+	return addfd_buffered(ctx,fd,rx,tx,state,TORQUE_PRIO_NORMAL,&t,NULL);
+}
+
+torque_err torque_addfd_framed(torque_ctx *ctx,int fd,const torque_framer *tf,
+		libtorqueframecb rx,libtorquebwcb tx,void *state){
+	rxframer *fr;
+
+	if(fd < 0 || !framer_valid(tf)){
+		return TORQUE_ERR_INVAL;
+	}
+	if((fr = create_rxframer(ctx,tf,rx,state)) == NULL){
+		return TORQUE_ERR_RESOURCE;
+	}
+	return addfd_buffered(ctx,fd,framed_rxfxn,tx,state,TORQUE_PRIO_NORMAL,
+				NULL,fr);
+}
+
+torque_err torque_addfd_http(torque_ctx *ctx,int fd,size_t maxbody,
+		libtorquehttpcb rx,libtorquebwcb tx,void *state){
+	httpparser *hp;
+
+	if(fd < 0){
+		return TORQUE_ERR_INVAL;
+	}
+	if((hp = create_httpparser(ctx,maxbody,rx,state)) == NULL){
+		return TORQUE_ERR_RESOURCE;
+	}
+	return addfd_buffered(ctx,fd,http_rxfxn,tx,state,TORQUE_PRIO_NORMAL,
+				NULL,hp);
+}
+
+torque_err torque_addfd_resp(torque_ctx *ctx,int fd,libtorquerespcb rx,
+				libtorquebwcb tx,void *state){
+	respparser *rp;
+
+	if(fd < 0){
+		return TORQUE_ERR_INVAL;
+	}
+	if((rp = create_respparser(ctx,rx,state)) == NULL){
+		return TORQUE_ERR_RESOURCE;
+	}
+	return addfd_buffered(ctx,fd,resp_rxfxn,tx,state,TORQUE_PRIO_NORMAL,
+				NULL,rp);
+}
+
 torque_err torque_addfd_unbuffered(torque_ctx *ctx,int fd,libtorquercb rx,
 				libtorquewcb tx,void *state){
-	if(fd < 0){
+	return torque_addfd_unbuffered_prio(ctx,fd,rx,tx,state,TORQUE_PRIO_NORMAL);
+}
+
+torque_err torque_addfd_unbuffered_prio(torque_ctx *ctx,int fd,libtorquercb rx,
+			libtorquewcb tx,void *state,torque_prio prio){
+	if(fd < 0 || prioritize(ctx,prio)){
 		return TORQUE_ERR_INVAL;
 	}
-	return add_fd_to_evhandler(ctx,&ctx->evq,fd,rx,tx,state,EVONESHOT);
+	return add_fd_to_evhandler_prio(ctx,local_evqueue(ctx),fd,rx,tx,state,
+						EVONESHOT,prio);
 }
 
+// Concurrent sources are watched by every evqueue, so that each scheduling
+// group can handle them (ie, accept(2) connections onto its own evqueue).
+// Registrations preceding a failure aren't undone, as those evqueues might
+// already be delivering events (see torque.h).
 torque_err torque_addfd_concurrent(torque_ctx *ctx,int fd,
 				libtorquercb rx,libtorquewcb tx,void *state){
+	const evqueue *evq;
+	torque_err ret;
+
 	if(fd < 0){
 		return TORQUE_ERR_INVAL;
 	}
-	return add_fd_to_evhandler(ctx,&ctx->evq,fd,rx,tx,state,0);
+	for(evq = &ctx->evq ; evq ; evq = evq->next){
+		if( (ret = add_fd_to_evhandler(ctx,evq,fd,rx,tx,state,
+				ctx->opts.leaderfollower ? EVEXCLUSIVE : 0)) ){
+			return ret;
+		}
+	}
+	return 0;
+}
+
+// A listener can't be freed once any evqueue has accepted it.
+torque_err torque_addlistener(torque_ctx *ctx,int sd,libtorquebrcb rx,
+				libtorquebwcb tx,void *state){
+	torque_listener *l;
+	const evqueue *evq;
+
+	if(sd < 0){
+		return TORQUE_ERR_INVAL;
+	}
+	if((l = create_listener(sd,rx,tx,state)) == NULL){
+		return TORQUE_ERR_RESOURCE;
+	}
+	for(evq = &ctx->evq ; evq ; evq = evq->next){
+		int ret;
+
+#ifdef TORQUE_LINUX_URING_RECV
+		if(evq->ring && evq->ring->bufring){
+			ret = uring_accept(evq,l);
+		}else
+#endif
+		ret = add_fd_to_evhandler(ctx,evq,sd,listener_rxfxn,NULL,l,
+				ctx->opts.leaderfollower ? EVEXCLUSIVE : 0);
+		if(ret){
+			if(evq == &ctx->evq){
+				free_listener(l);
+			}
+			return TORQUE_ERR_RESOURCE;
+		}
+	}
+	return 0;
 }
 
 torque_err torque_addconnector(torque_ctx *ctx,int fd,const struct sockaddr *addr,
@@ -270,7 +498,7 @@ torque_err torque_addconnector(torque_ctx *ctx,int fd,const struct sockaddr *add
 
 			if((connctx = create_conncb(rx,tx,state)) == NULL){
 				ret = TORQUE_ERR_SYSCALL + errno;
-			}else if( (ret = add_fd_to_evhandler(ctx,&ctx->evq,fd,NULL,
+			}else if( (ret = add_fd_to_evhandler(ctx,local_evqueue(ctx),fd,NULL,
 					conn_unbuffered_txfxn,connctx,EVONESHOT)) ){
 				free_conncb(connctx);
 			}
@@ -297,7 +525,7 @@ torque_err torque_addconnector_unbuffered(torque_ctx *ctx,int fd,const struct so
 
 			if((connctx = create_conncb(rx,tx,state)) == NULL){
 				ret = TORQUE_ERR_SYSCALL + errno;
-			}else if( (ret = add_fd_to_evhandler(ctx,&ctx->evq,fd,NULL,
+			}else if( (ret = add_fd_to_evhandler(ctx,local_evqueue(ctx),fd,NULL,
 					conn_unbuffered_txfxn,connctx,EVONESHOT)) ){
 				free_conncb(connctx);
 			}
@@ -310,27 +538,69 @@ torque_err torque_addconnector_unbuffered(torque_ctx *ctx,int fd,const struct so
 	return ret;
 }
 
+torque_err torque_addproxy(torque_ctx *ctx,int sa,int sb,
+				libtorqueproxycb donefxn,void *state){
+#ifdef TORQUE_LINUX
+	torque_proxy *p;
+	torque_err ret;
+
+	if(sa < 0 || sb < 0 || sa == sb){
+		return TORQUE_ERR_INVAL;
+	}
+	if((p = create_proxy(sa,sb,donefxn,state)) == NULL){
+		return TORQUE_ERR_SYSCALL + errno;
+	}
+	if( (ret = add_fd_to_evhandler(ctx,local_evqueue(ctx),p->epfd,
+					proxy_rxfxn,NULL,p,EVONESHOT)) ){
+		free_proxy(p);
+	}
+	return ret;
+#else
+	(void)ctx;
+	(void)sa;
+	(void)sb;
+	(void)donefxn;
+	(void)state;
+	return TORQUE_ERR_UNAVAIL;
+#endif
+}
+
 torque_err torque_addpath(torque_ctx *ctx,const char *path,libtorquercb rx,void *state){
-	if(add_fswatch_to_evhandler(&ctx->evq,path,rx,state)){
+	if(add_fswatch_to_evhandler(local_evqueue(ctx),path,rx,state)){
 		return TORQUE_ERR_UNAVAIL; // FIXME
 	}
 	return 0;
 }
 
 #ifndef LIBTORQUE_WITHOUT_SSL
-torque_err torque_addssl(torque_ctx *ctx,int fd,SSL_CTX *sslctx,
-			libtorquebrcb rx,libtorquebwcb tx,void *state){
+static torque_err
+addssl(torque_ctx *ctx,int fd,SSL_CTX *sslctx,libtorquebrcb rx,
+		libtorquebwcb tx,void *state,const torque_timeouts *tos){
 	struct ssl_cbstate *cbs;
 
 	if((cbs = create_ssl_cbstate(ctx,sslctx,state,rx,tx)) == NULL){
 		return TORQUE_ERR_RESOURCE; // FIXME not necessarily correct
 	}
+	if(tos){
+		ssl_set_timeouts(cbs,tos);
+	}
 	if(torque_addfd_unbuffered(ctx,fd,ssl_accept_rxfxn,NULL,cbs)){
 		free_ssl_cbstate(cbs);
 		return TORQUE_ERR_RESOURCE; // FIXME not necessarily correct
 	}
 	return 0;
 }
+
+torque_err torque_addssl(torque_ctx *ctx,int fd,SSL_CTX *sslctx,
+			libtorquebrcb rx,libtorquebwcb tx,void *state){
+	return addssl(ctx,fd,sslctx,rx,tx,state,NULL);
+}
+
+torque_err torque_addssl_timeouts(torque_ctx *ctx,int fd,SSL_CTX *sslctx,
+			libtorquebrcb rx,libtorquebwcb tx,void *state,
+			const torque_timeouts *tos){
+	return addssl(ctx,fd,sslctx,rx,tx,state,tos);
+}
 #else
 torque_err torque_addssl(torque_ctx *ctx __attribute__ ((unused)),
 				int fd __attribute__ ((unused)),
@@ -340,11 +610,22 @@ torque_err torque_addssl(torque_ctx *ctx __attribute__ ((unused)),
 				void *state __attribute__ ((unused))){
 	return TORQUE_ERR_UNAVAIL;
 }
+
+torque_err torque_addssl_timeouts(torque_ctx *ctx __attribute__ ((unused)),
+				int fd __attribute__ ((unused)),
+				SSL_CTX *sslctx __attribute__ ((unused)),
+				libtorquebrcb rx __attribute__ ((unused)),
+				libtorquebwcb tx __attribute__ ((unused)),
+				void *state __attribute__ ((unused)),
+				const torque_timeouts *tos __attribute__ ((unused))){
+	return TORQUE_ERR_UNAVAIL;
+}
 #endif
 
 #ifndef LIBTORQUE_WITHOUT_ADNS
 torque_err torque_addlookup_dns(torque_ctx *ctx,const char *owner,
 					libtorquednscb rx,void *state){
+	const evqueue *evq = local_evqueue(ctx);
 	struct dnsmarshal *dm;
 	adns_query query;
 
@@ -353,11 +634,11 @@ torque_err torque_addlookup_dns(torque_ctx *ctx,const char *owner,
 	}
 	// FIXME need to lock adns struct...should be one per evqueue
 	// FIXME need allow other than A type!
-	if(adns_submit(ctx->evq.dnsctx,owner,adns_r_a,adns_qf_none,dm,&query)){
+	if(adns_submit(evq->dnsctx,owner,adns_r_a,adns_qf_none,dm,&query)){
 		free_dnsmarshal(dm);
 		return TORQUE_ERR_INVAL; // FIXME break down error cases
 	}
-	if(load_dns_fds(ctx,&ctx->evq.dnsctx,&ctx->evq)){
+	if(load_dns_fds(ctx,&evq->dnsctx,evq)){
 		adns_cancel(query);
 		free_dnsmarshal(dm);
 		return TORQUE_ERR_ASSERT; // FIXME break down error cases
@@ -5,12 +5,16 @@
 extern "C" {
 #endif
 
+#include <time.h>
+#include <stdint.h>
 #include <signal.h>
+#include <sys/types.h>
 #include <sys/socket.h>
 
 struct itimerspec;
 struct torque_ctx;
 struct torque_rxbuf;
+struct torque_txbuf;
 
 // Errors can be converted to a string via torque_errstr().
 typedef enum {
@@ -67,6 +71,111 @@ struct torque_ctx *torque_init(torque_err *)
 	__attribute__ ((nonnull(1)))
 	__attribute__ ((malloc));
 
+// How event queues are laid out across the processing elements. By default,
+// all threads share a single kernel event queue. Partitioning the queue along
+// the scheduling topology (see torque_get_topology()) removes cross-package
+// contention on the kernel's event queue locks and ready list, at the cost of
+// locality being determined by registration: event sources registered from
+// within a callback remain on the registering thread's evqueue, while those
+// registered from other threads are distributed among the evqueues.
+// Sources registered via torque_addfd_concurrent() are watched by all
+// evqueues.
+//
+// With TORQUE_EVQ_THREAD, each thread has a private evqueue, and thus owns
+// all sources registered upon it. Owned file descriptors are registered
+// edge-triggered without one-shot semantics, and need not be rearmed after
+// each event (saving a system call per event). The guarantee that a handler is
+// never run in more than one thread at a time is preserved.
+typedef enum {
+	TORQUE_EVQ_SHARED = 0,	// one evqueue shared by all threads
+	TORQUE_EVQ_PACKAGE,	// one evqueue per package
+	TORQUE_EVQ_CORE,	// one evqueue per core (shared by SMT threads)
+	TORQUE_EVQ_THREAD,	// one private evqueue per thread
+} torque_evqmode;
+
+// The kernel event notification mechanism underlying the evqueues. By default,
+// the native mechanism is used: epoll on Linux, and kqueue on FreeBSD. On
+// Linux 5.5 and later, io_uring can be used instead: readiness is tracked via
+// poll requests, and all rearms made during a round of callbacks are submitted
+// together as part of the next wait, rather than via one system call apiece.
+// Where io_uring is unavailable (older kernels, or its use being disallowed),
+// the native mechanism is silently used. Callbacks are unaffected by the
+// choice. Owned sources of TORQUE_EVQ_THREAD remain one-shot under io_uring,
+// their rearms being batched.
+typedef enum {
+	TORQUE_BACKEND_NATIVE = 0,	// epoll() or kqueue()
+	TORQUE_BACKEND_URING,		// io_uring, falling back to native
+} torque_evbackend;
+
+// Event sources belong to one of several priority classes, or lanes. Once any
+// source has been registered with a class other than TORQUE_PRIO_NORMAL, each
+// round's events are dispatched by class, highest first. A class dispatches
+// at most its budget (torque_opts.lanebudget) of events per round; the rest
+// are deferred to following rounds, which then don't block in the kernel, but
+// pick up any newly-ready (and possibly higher-priority) events. libtorque's
+// internal signal handling is of TORQUE_PRIO_CONTROL.
+typedef enum {
+	TORQUE_PRIO_CONTROL = 0,	// control plane, health checks
+	TORQUE_PRIO_NORMAL,		// the default
+	TORQUE_PRIO_BULK,		// bulk data transfer
+} torque_prio;
+
+#define TORQUE_PRIO_CLASSES 3
+
+// Parameters for torque_init_opts(). A zero-initialized torque_opts results
+// in the same behavior as torque_init().
+//
+// Each thread adapts the number of events it retrieves per round to its recent
+// load, the number of threads sharing its evqueue, and the size of its L1 data
+// cache. evecmin and evecmax bound this adaptation; zero selects the default
+// for either (TORQUE_EVEC_MIN and TORQUE_EVEC_MAX).
+//
+// For latency-critical loads, a non-zero spinus has each thread poll its
+// evqueue without blocking for up to that many microseconds before sleeping
+// in the kernel, trading CPU for wakeup latency. A window expiring without
+// events gives up the CPU. With busypoll also set, registered sockets have
+// SO_BUSY_POLL set to the same window (Linux 3.11+; raising it above the
+// net.core.busy_read sysctl requires CAP_NET_ADMIN, and failure is ignored).
+//
+// With leaderfollower set, only one thread (the leader) of each shared
+// evqueue waits in the kernel. Upon retrieving events, it promotes a parked
+// follower to leader before dispatching them, and parks itself once done.
+// Concurrent sources and listeners are furthermore registered with
+// EPOLLEXCLUSIVE (Linux 4.5+), so that one readiness event wakes only one of
+// the evqueues watching them. The spuriouswakes stat counts wakeups which
+// were wasted: rounds all of whose events found no work (ie, a listener's
+// connections having already been accepted by other threads), and waits
+// returning without events.
+//
+// With coarseclock set, torque_now() is sampled from a coarse clock
+// (CLOCK_MONOTONIC_COARSE on Linux, CLOCK_MONOTONIC_FAST on FreeBSD), cheaper
+// to read but of only scheduler-tick resolution.
+typedef struct torque_opts {
+	torque_evqmode evqmode;		// evqueue partitioning
+	torque_evbackend evbackend;	// kernel event mechanism
+	unsigned evecmin,evecmax;	// bounds on events retrieved per round
+	unsigned spinus;		// busy-poll window in microseconds
+	int busypoll;			// set SO_BUSY_POLL (spinus) on sockets
+	int leaderfollower;		// one thread per evqueue waits (Linux)
+	unsigned lanebudget[TORQUE_PRIO_CLASSES]; // events per round per lane
+	int coarseclock;		// sample torque_now() from a coarse clock
+} torque_opts;
+
+#define TORQUE_EVEC_MIN 8
+#define TORQUE_EVEC_MAX 512
+
+// A zero lanebudget selects the default: unlimited, save for TORQUE_PRIO_BULK.
+#define TORQUE_LANE_UNLIMITED ((unsigned)-1)
+#define TORQUE_LANE_BULK 32
+
+// As torque_init(), but with the specified parameters. A NULL torque_opts is
+// equivalent to a zeroed one.
+struct torque_ctx *torque_init_opts(const torque_opts *,torque_err *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(2)))
+	__attribute__ ((malloc));
+
 // Multiple threads may add event sources to a libtorque instance concurrently,
 // so long as they are not adding the same event source (ie, the callers must
 // be able to guarantee the signals, fds, whatever are not the same). The
@@ -78,8 +187,18 @@ struct torque_ctx *torque_init(torque_err *)
 typedef void (*libtorquercb)(int,void *);
 typedef void (*libtorquewcb)(int,void *);
 typedef void (*libtorquetimecb)(void *);
+typedef void (*libtorquepostcb)(void *);
 typedef int (*libtorquebrcb)(int,struct torque_rxbuf *,void *);
 typedef int (*libtorquebwcb)(int,struct torque_rxbuf *,void *);
+typedef void (*libtorquerelcb)(const void *,size_t,void *);
+typedef void (*libtorquewmcb)(int,struct torque_txbuf *,void *);
+typedef void (*libtorquesentcb)(int,size_t,int,void *);
+typedef void (*libtorqueproxycb)(int,int,uint64_t,uint64_t,int,void *);
+typedef int (*libtorqueframecb)(int,struct torque_rxbuf *,const char *,size_t,void *);
+struct torque_httpreq;
+typedef int (*libtorquehttpcb)(int,struct torque_rxbuf *,const struct torque_httpreq *,void *);
+struct torque_respcmd;
+typedef int (*libtorquerespcb)(int,struct torque_rxbuf *,const struct torque_respcmd *,unsigned,void *);
 
 // Invoke the callback upon receipt of any of the specified signals. The signal
 // set may not contain EVTHREAD_TERM (usually SIGTERM), SIGKILL or SIGSTOP.
@@ -89,22 +208,370 @@ torque_err torque_addsignal(struct torque_ctx *,const sigset_t *,
 	__attribute__ ((warn_unused_result))
 	__attribute__ ((nonnull(1,2,3)));
 
-// After a minimum time interval, invoke the callback as soon as possible.
-torque_err torque_addtimer(struct torque_ctx *,
-		const struct itimerspec *,libtorquetimecb,void *)
+// Details of the signal being handled, including the payload of a queued
+// (sigqueue(3)) realtime signal. Each queued instance of a realtime signal
+// invokes the callback once, with its own payload.
+typedef struct torque_siginfo {
+	int signo;
+	int code;			// si_code: SI_QUEUE, SI_USER, etc.
+	pid_t pid;			// sender
+	uid_t uid;			// sender's real uid
+	union sigval value;		// sigqueue(3) payload
+} torque_siginfo;
+
+// Valid only within a signal callback, on the calling thread. Returns NULL
+// where the event mechanism doesn't supply siginfo (FreeBSD's EVFILT_SIGNAL,
+// and Linux without signalfd).
+const torque_siginfo *torque_getsiginfo(void)
+	__attribute__ ((visibility("default")));
+
+// The CLOCK_MONOTONIC time, in nanoseconds, as of the calling event thread's
+// most recent retrieval of events. Every callback of a round thus sees the
+// same time, without reading the clock. Outside of event threads, the clock
+// is read directly. Relative timers and connection timeouts are measured from
+// this time.
+uint64_t torque_now(void)
+	__attribute__ ((visibility("default")));
+
+// Timers are kept in a timing wheel with a resolution of about 1ms, and do
+// not consume file descriptors. They're scheduled as with timerfd_settime(2):
+// the callback is invoked as soon as possible after it_value, which is an
+// interval from now, or an absolute CLOCK_MONOTONIC time given the
+// TORQUE_TIMER_ABSTIME flag. A non-zero it_interval reschedules the callback
+// periodically. A zero it_value leaves the timer disarmed.
+//
+// A non-NULL slack permits each expiry to be delayed by up to that much,
+// letting expiries with overlapping windows be handled in a single wakeup
+// (the timerscoalesced statistic counts timers fired by another's wakeup).
+// Generous slack on timeouts and housekeeping timers saves wakeups.
+#define TORQUE_TIMER_ABSTIME 0x1
+
+struct torque_timer;
+
+// If the final parameter is non-NULL, it receives a handle for the timer,
+// which remains valid (whether the timer is armed or not) until passed to
+// torque_deltimer(), or until the context is stopped. Otherwise, the timer
+// can't be modified, and is freed once it has fired (if one-shot).
+torque_err torque_addtimer(struct torque_ctx *,int,const struct itimerspec *,
+			const struct timespec *,libtorquetimecb,void *,
+			struct torque_timer **)
 	__attribute__ ((visibility("default")))
 	__attribute__ ((warn_unused_result))
-	__attribute__ ((nonnull(1,2,3)));
+	__attribute__ ((nonnull(1,3,5)));
+
+// Rearm (or, with a zero it_value, disarm) the timer, replacing its previous
+// schedule (its slack is retained). This neither allocates nor, unless the
+// new deadline precedes all others, makes a system call; it's suitable for
+// pushing back an idle timeout upon each read. It may be called from any
+// thread, including from the timer's own callback.
+torque_err torque_modtimer(struct torque_timer *,int,const struct itimerspec *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,3)));
+
+// Cancel and free the timer. The callback will not be invoked afterwards,
+// though an invocation already underway on another thread might be running
+// when this returns.
+void torque_deltimer(struct torque_timer *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((nonnull(1)));
+
+// Hand a task to the event threads from any thread, without locking. Called
+// from an event thread, the task runs on that thread's evqueue; otherwise,
+// evqueues are chosen round-robin. Tasks of an evqueue are run in batches,
+// in the order posted, and only the first post to find the evqueue's queue
+// empty makes a system call (to wake an event thread).
+torque_err torque_post(struct torque_ctx *,libtorquepostcb,void *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2)));
+
+// As torque_post(), but run the task on the evqueue of the specified
+// processor's event thread (by affinity ID, as in the topology), keeping the
+// task's data within that processor's caches where evqueues are partitioned
+// (see torque_evqmode). Fails with TORQUE_ERR_INVAL if no event thread runs
+// on the processor.
+torque_err torque_post_aid(struct torque_ctx *,unsigned,libtorquepostcb,void *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,3)));
+
+// Optional timeouts for buffered connections. A zero timespec disables the
+// corresponding timeout. rxidle bounds the time between read events, txidle
+// the time between write events (it's ignored absent a write callback), and
+// lifetime the time since registration. Upon expiry, libtorque shuts down the
+// connection (waking it even while it awaits a peer which won't read), calls
+// expirecb (if non-NULL) with the fd, the expired timeout, and the registered
+// callback state, and then closes the fd and frees its buffers. The fd must be a socket. Deadlines are checked
+// lazily, using the timers of torque_addtimer(); events cost no timer
+// operations, and no file descriptors are consumed. An expiry may lag its
+// deadline by up to a sixteenth of the shortest timeout, so that timeouts of
+// nearby deadlines share wakeups. Expiries are counted in the event threads'
+// statistics.
+typedef enum {
+	TORQUE_TIMEOUT_RXIDLE,
+	TORQUE_TIMEOUT_TXIDLE,
+	TORQUE_TIMEOUT_LIFETIME,
+} torque_timeout;
+
+typedef void (*libtorquetocb)(int,torque_timeout,void *);
+
+typedef struct torque_timeouts {
+	struct timespec rxidle,txidle,lifetime;
+	libtorquetocb expirecb;
+} torque_timeouts;
 
 // Watch for events on the specified file descriptor, and invoke the callbacks.
 // Employ libtorque's read buffering. A buffered read callback must return -1
-// if the descriptor has been closed, and 0 otherwise.
+// if the descriptor has been closed, and 0 otherwise. Buffered callbacks are
+// passed libtorque's own state for the connection as their final argument,
+// not the state registered here; clients needing theirs must look it up
+// themselves (ie, by fd). The framed, HTTP and RESP callbacks do get it.
 torque_err torque_addfd(struct torque_ctx *,int,libtorquebrcb,
 					libtorquebwcb,void *)
 	__attribute__ ((visibility("default")))
 	__attribute__ ((warn_unused_result))
 	__attribute__ ((nonnull(1)));
 
+// The same as torque_addfd, but in the specified priority class.
+torque_err torque_addfd_prio(struct torque_ctx *,int,libtorquebrcb,
+				libtorquebwcb,void *,torque_prio)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
+// The same as torque_addfd, but subject to the specified timeouts.
+torque_err torque_addfd_timeouts(struct torque_ctx *,int,libtorquebrcb,
+			libtorquebwcb,void *,const torque_timeouts *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,6)));
+
+// Framed fds have their buffered input cut into frames by libtorque, their
+// read callback being called once per complete frame with the fd, the
+// torque_rxbuf (for torque_gettxbuf()), the frame's payload (without length
+// prefix or delimiter) and its length, and the registered callback state.
+// The payload is valid only within the callback. Input consumed between
+// events is remembered, so that a frame arriving piecemeal is only scanned
+// once. The read callback is called without a frame (NULL and 0) upon end of
+// input, whereupon any partial frame is discarded, or should a frame exceed
+// maxframe, whereupon the read side is shut down and further input discarded.
+// Its return is that of a buffered read callback. Delimiters are sought using
+// SSE2 or AVX2, as the processors support.
+typedef enum {
+	TORQUE_FRAME_FIXED,		// frames of len bytes
+	TORQUE_FRAME_PREFIX_BE,		// a len-byte big-endian payload length
+	TORQUE_FRAME_PREFIX_LE,		// a len-byte little-endian payload length
+	TORQUE_FRAME_DELIM,		// payloads terminated by delim
+} torque_framing;
+
+typedef struct torque_framer {
+	torque_framing mode;
+	size_t len;			// frame length, or prefix width (1--8)
+	size_t maxframe;		// largest payload (0 for no limit)
+	const char *delim;		// copied upon registration
+	size_t delimlen;
+} torque_framer;
+
+torque_err torque_addfd_framed(struct torque_ctx *,int,const torque_framer *,
+			libtorqueframecb,libtorquebwcb,void *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,3,4)));
+
+// HTTP/1.x servers' buffered fds, whose read callback is called once per
+// complete request (request line, headers and body), with the fd, the
+// torque_rxbuf (for torque_gettxbuf()), the request, and the registered
+// callback state. Pipelined requests are delivered in order. The request's
+// strings are slices of the input, valid only within the callback, and not
+// NUL-terminated. A chunked body is delivered decoded (its trailers are
+// discarded). Bodies larger than maxbody (0 for no limit), header blocks
+// larger than 64KB, and more than TORQUE_HTTP_MAXHEADERS headers are treated
+// as malformed. The read callback is called without a request (NULL) upon
+// end of input, or should a request be malformed, whereupon the read side is
+// shut down and further input discarded (the callback might queue a 400
+// response). Its return is that of a buffered read callback.
+#define TORQUE_HTTP_MAXHEADERS 64
+
+typedef struct torque_httphdr {
+	const char *name,*value;	// value stripped of surrounding whitespace
+	size_t namelen,valuelen;
+} torque_httphdr;
+
+typedef struct torque_httpreq {
+	const char *method,*target;
+	size_t methodlen,targetlen;
+	unsigned minor;			// HTTP/1.minor
+	int keepalive;			// per version and Connection header
+	unsigned headercount;
+	torque_httphdr headers[TORQUE_HTTP_MAXHEADERS];
+	const char *body;
+	size_t bodylen;
+} torque_httpreq;
+
+torque_err torque_addfd_http(struct torque_ctx *,int,size_t,libtorquehttpcb,
+				libtorquebwcb,void *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,4)));
+
+// RESP (REdis Serialization Protocol) servers' buffered fds. Every complete
+// command in the input is parsed upon each read, and the commands are passed
+// to the read callback in batches, with the fd, the torque_rxbuf (for
+// torque_gettxbuf()), the commands and their number, and the registered
+// callback state. Commands are arrays of bulk strings, or inline commands
+// (arguments separated by whitespace on a line). Their arguments are slices
+// of the input, valid only within the callback, and not NUL-terminated. The
+// callback ought queue one reply per command, in order, using the encoders
+// below; replies to a whole batch (indeed, to everything read in one event)
+// are written with a single writev(2), rather than one write per command.
+// Commands of more than 1M arguments, bulk strings larger than 512MB and
+// inline commands longer than 64KB are treated as malformed. The read
+// callback is called without commands (NULL and 0) upon end of input, or
+// should a command be malformed, whereupon the read side is shut down and
+// further input discarded (the callback might queue an error reply). Its
+// return is that of a buffered read callback.
+typedef struct torque_respstr {
+	const char *str;
+	size_t len;
+} torque_respstr;
+
+typedef struct torque_respcmd {
+	unsigned argc;
+	const torque_respstr *argv;
+} torque_respcmd;
+
+torque_err torque_addfd_resp(struct torque_ctx *,int,libtorquerespcb,
+				libtorquebwcb,void *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,3)));
+
+// RESP reply encoders, queueing onto a buffered fd's torque_txbuf. Simple
+// strings and errors mustn't contain CR or LF (TORQUE_ERR_INVAL). A count of
+// -1 queues a null array. Should queueing fail, part of the reply might have
+// been queued, and the connection ought be closed.
+torque_err torque_resp_simple(struct torque_txbuf *,const char *,size_t)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2)));
+
+torque_err torque_resp_error(struct torque_txbuf *,const char *,size_t)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2)));
+
+torque_err torque_resp_integer(struct torque_txbuf *,long long)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
+torque_err torque_resp_bulk(struct torque_txbuf *,const void *,size_t)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2)));
+
+torque_err torque_resp_null(struct torque_txbuf *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
+torque_err torque_resp_array(struct torque_txbuf *,long long)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
+// Buffered fds queue their output in a torque_txbuf, retrieved from the
+// torque_rxbuf passed to their callbacks via torque_gettxbuf() (SSL
+// connections have none, and get NULL). Output queued by a callback is
+// written out with writev(2) once the callback returns, gathering everything
+// queued; whatever the fd won't take is written as it becomes writable, write
+// interest being registered only while output remains queued. A write
+// callback is called as the fd becomes writable with nothing queued: upon
+// registration, and once queued output has been written. The queue mustn't
+// be used outside of the fd's callbacks. Should a read callback retain the fd
+// upon end of input (being called without input, and returning 0), anything
+// queued is still written; should a callback close the fd, anything queued
+// is discarded.
+struct torque_txbuf *torque_gettxbuf(struct torque_rxbuf *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((nonnull(1)));
+
+// Queue a copy of the output. Small outputs are coalesced.
+torque_err torque_txcopy(struct torque_txbuf *,const void *,size_t)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2)));
+
+// Queue the output in place. It mustn't be modified until the release
+// callback (if non-NULL) is called with the buffer, its length, and the
+// provided state, once it's been written or discarded. It's called even if
+// queueing fails.
+torque_err torque_txref(struct torque_txbuf *,const void *,size_t,
+				libtorquerelcb,void *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,2)));
+
+// Queue len bytes of the file filefd, from offset off (or, with a len of 0,
+// everything from off to the end of the file as it is now). The file is sent
+// with sendfile(2), without passing through userspace, as the fd becomes
+// writable, in order with the remainder of the queue; files which can't be
+// sent thusly are read and written in page-sized pieces. The file's offset is
+// unaffected, and it mustn't be closed until sentcb (if non-NULL) is called
+// with filefd, the bytes sent, an errno (0 on success, ECANCELED if the queue
+// was discarded), and the provided state -- even should queueing fail. A file
+// ending early completes the send, reporting the bytes actually sent.
+torque_err torque_sendfile(struct torque_txbuf *,int,off_t,size_t,
+				libtorquesentcb,void *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
+// Write as much queued output as the fd will take now, rather than once the
+// callback returns. Failure to write discards the queue.
+torque_err torque_txflush(struct torque_txbuf *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
+// Send queued output in segments of at least thresh bytes (those referenced
+// by torque_txref(), or copies that large) with MSG_ZEROCOPY, sparing the
+// copy into the kernel (Linux 4.14+, TCP). Such output isn't released until
+// the kernel reports its transmission complete, via the socket's error queue;
+// the fd is watched for this even with nothing left queued, and a lingering
+// close (torque_txclose()) awaits it. Pinning pages costs more than copying
+// small writes, so thresh ought be 10KB or more. Over loopback, the kernel
+// copies regardless (see the zccopied stat). A thresh of 0 disables zerocopy,
+// as it is by default. Elsewhere, TORQUE_ERR_UNAVAIL is returned.
+torque_err torque_txzerocopy(struct torque_txbuf *,size_t)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
+// Bytes queued, but not yet written, including what remains of files.
+size_t torque_txqueued(const struct torque_txbuf *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((nonnull(1)));
+
+// Backpressure. Once at least hiwat bytes are queued, hicb is called (from
+// within the queueing call) with the fd, the queue, and the registered
+// callback state; once no more than lowat remain (lowat < hiwat), locb is
+// called likewise, from the writing of the queue. A hiwat of 0 disables the
+// callbacks, as it is by default.
+torque_err torque_txwatermarks(struct torque_txbuf *,size_t,size_t,
+				libtorquewmcb,libtorquewmcb)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
+// Close the fd once its queued output has been written (immediately, if
+// there's none). The callback must then return -1, as if it had closed the
+// fd itself.
+void torque_txclose(struct torque_txbuf *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((nonnull(1)));
+
 // The same as torque_addfd, but manage buffering in the application,
 // calling back immediately on all events (but not in more than one thread).
 torque_err torque_addfd_unbuffered(struct torque_ctx *,int,
@@ -113,6 +580,13 @@ torque_err torque_addfd_unbuffered(struct torque_ctx *,int,
 	__attribute__ ((warn_unused_result))
 	__attribute__ ((nonnull(1)));
 
+// The same as torque_addfd_unbuffered, but in the specified priority class.
+torque_err torque_addfd_unbuffered_prio(struct torque_ctx *,int,
+				libtorquercb,libtorquewcb,void *,torque_prio)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
 // Connect to the specified address, and watch for events on the resulting file
 // descriptor, invoking the specified callbacks. Employ libtorque's read
 // buffering. A buffered read callback must return -1 if the descriptor has
@@ -133,13 +607,50 @@ torque_err torque_addconnector_unbuffered(struct torque_ctx *,int,const struct s
 
 // The same as torque_addfd_unbuffered, but allow multiple threads to handle
 // event readiness notifications concurrently. This is (currently) the
-// preferred methodology for accept(2)ing sockets.
+// preferred methodology for accept(2)ing sockets. The fd is registered upon
+// each evqueue in turn; should that fail upon one, it remains registered
+// upon those preceding it, whose threads might already be calling back with
+// the state. Upon failure, the caller ought close the fd (removing it from
+// those evqueues), and mustn't free the state.
 torque_err torque_addfd_concurrent(struct torque_ctx *,int,
 				libtorquercb,libtorquewcb,void *)
 	__attribute__ ((visibility("default")))
 	__attribute__ ((warn_unused_result))
 	__attribute__ ((nonnull(1)));
 
+// Accept connections on the specified listening socket, registering each with
+// the buffered callbacks as if by torque_addfd. Accepted sockets are
+// nonblocking and close-on-exec. Like concurrent sources, the listener is
+// watched by every evqueue, and connections land on the accepting thread's.
+// On io_uring evqueues (Linux 5.19+), accepts are multishot, and connections
+// lacking a write callback receive into kernel-provided buffers, handed to the
+// read callback without an intervening copy (unreleased input is copied
+// aside). Note that such outstanding requests hold a reference to the socket:
+// the connection isn't torn down until libtorque cancels them, following a
+// read callback's return of -1.
+torque_err torque_addlistener(struct torque_ctx *,int,libtorquebrcb,
+					libtorquebwcb,void *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
+// Relay bytes between two connected stream sockets, in both directions, until
+// both directions have finished or either fails. Bytes move through a pair of
+// kernel pipes via splice(2), never entering userspace; a direction whose
+// pipe is full stops reading until its destination drains it. End-of-file
+// read from either socket is passed along as a shutdown(2) for writing of
+// the other, once everything before it has been written, while the opposite
+// direction carries on. The sockets are made nonblocking, and mustn't
+// otherwise be registered. Upon teardown, the callback (if non-NULL) is
+// invoked with the two sockets, the bytes relayed from the first to the
+// second and from the second to the first, 0 or the errno which ended the
+// relay, and the provided state, after which libtorque closes both sockets.
+// Linux only; elsewhere, TORQUE_ERR_UNAVAIL is returned.
+torque_err torque_addproxy(struct torque_ctx *,int,int,libtorqueproxycb,void *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1)));
+
 // Watch for events on the specified path, and invoke the callback.
 torque_err torque_addpath(struct torque_ctx *,const char *,
 					libtorquercb,void *)
@@ -179,6 +690,14 @@ torque_err torque_addssl(struct torque_ctx *,int,SSL_CTX *,
 	__attribute__ ((warn_unused_result))
 	__attribute__ ((nonnull(1,3)));
 
+// The same as torque_addssl, but subjecting each accepted connection to the
+// specified timeouts (including during its handshake).
+torque_err torque_addssl_timeouts(struct torque_ctx *,int,SSL_CTX *,
+			libtorquebrcb,libtorquebwcb,void *,const torque_timeouts *)
+	__attribute__ ((visibility("default")))
+	__attribute__ ((warn_unused_result))
+	__attribute__ ((nonnull(1,3,7)));
+
 struct ssl_cbstate;
 
 int ssl_tx(int,struct ssl_cbstate *,const void *,int)
@@ -231,9 +231,9 @@ int main(int argc,char **argv){
 	if(timeout){
 		struct itimerspec it;
 
-		memset(&it,0,sizeof(it)); // FIXME
-		it.it_interval.tv_sec = timeout;
-		if( (err = torque_addtimer(ctx,&it,timeoutcb,NULL)) ){
+		memset(&it,0,sizeof(it));
+		it.it_value.tv_sec = timeout;
+		if( (err = torque_addtimer(ctx,0,&it,NULL,timeoutcb,NULL,NULL)) ){
 			fprintf(stderr,"Couldn't add timer (%s)\n",
 					torque_errstr(err));
 			goto err;
@@ -15,35 +15,22 @@
 
 static int
 echo_server(int fd,struct torque_rxbuf *rxb,void *v __attribute__ ((unused))){
+	struct torque_txbuf *txb = torque_gettxbuf(rxb);
 	const char *buf;
-	size_t len,w;
+	size_t len;
 
 	buf = rxbuffer_valid(rxb,&len);
 	if(len == 0){
 		fprintf(stdout,"[%4d] closed\n",fd);
-		goto err; // FIXME could still need to transmit
+		torque_txclose(txb); // once whatever's queued has been written
+		return -1;
 	}
 	fprintf(stdout,"[%4d] Read %zub\n",fd,len);
-	w = 0;
-	while(w < len){
-		ssize_t r;
-
-		r = write(fd,buf + w,len - w);
-		if(r < 0){
-			if(errno == EAGAIN || errno == EWOULDBLOCK){
-				// FIXME register for TX
-				break;
-			}else if(errno != EINTR){
-				fprintf(stderr,"[%4d] Error %d (%s) writing %zub\n",fd,
-						errno,strerror(errno),len);
-				goto err;
-			}
-		}else{
-			w += r;
-		}
+	if(torque_txcopy(txb,buf,len)){
+		fprintf(stderr,"[%4d] Couldn't queue %zub\n",fd,len);
+		goto err;
 	}
-	printf("wrote %zu/%zu\n",w,len);
-	rxbuffer_advance(rxb,w);
+	rxbuffer_advance(rxb,len);
 	return 0;
 
 err:
@@ -51,35 +38,6 @@ err:
 	return -1;
 }
 
-static void
-conn_handler(int fd,void *v){
-	struct torque_ctx *ctx = v;
-
-	do{
-		struct sockaddr sina;
-		socklen_t slen;
-		int sd;
-
-		slen = sizeof(sina);
-		while((sd = accept(fd,&sina,&slen)) >= 0){
-			int flags;
-
-			fprintf(stdout,"Got new connection on sd %d\n",sd);
-			if(((flags = fcntl(sd,F_GETFL)) < 0) ||
-					fcntl(sd,F_SETFL,flags | (long)O_NONBLOCK)){
-				close(sd);
-			}else if(torque_addfd(ctx,sd,echo_server,NULL,NULL)){
-				fprintf(stderr,"Couldn't add client sd %d\n",sd);
-				close(sd);
-			}
-		}
-	}while(errno == EINTR);
-	if(errno != EAGAIN && errno != EWOULDBLOCK){
-		fprintf(stdout,"Accept() callback errno %d (%s)\n",
-				errno,strerror(errno));
-	}
-}
-
 static int
 make_echo_fd(int domain,const struct sockaddr *saddr,socklen_t slen){
 	int sd,reuse = 1,flags;
@@ -206,7 +164,7 @@ int main(int argc,char **argv){
 		goto err;
 	}
 	printf("Registering server sd %d, port %hu\n",sd,ntohs(su.sin.sin_port));
-	if(torque_addfd_concurrent(ctx,sd,conn_handler,NULL,ctx)){
+	if(torque_addlistener(ctx,sd,echo_server,NULL,NULL)){
 		fprintf(stderr,"Couldn't add server sd %d\n",sd);
 		goto err;
 	}
@@ -0,0 +1,220 @@
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <libtorque/torque.h>
+
+// Check that timeouts tear down a connection whose peer never reads. A single
+// connection is registered with libtorque with txidle and lifetime timeouts;
+// its write callback queues more than the socket buffers will take, and asks
+// (via torque_txclose()) that it be closed once written. The main thread
+// holds the other end open without reading, so the output never drains, and
+// only a timeout can end the connection. We fail should it outlive a grace
+// period beyond its deadline.
+#define QUEUED		(64u << 20)
+#define DEFAULT_SECS	2
+#define GRACE_SECS	2
+
+typedef struct checkstate {
+	int expired;			// set by expirecb
+	torque_timeout why;
+} checkstate;
+
+// Buffered callbacks get libtorque's connection state rather than ours (see
+// torque_addfd()), so the check's state is found here.
+static checkstate check;
+static char *buf;
+
+static void
+print_version(void){
+	fprintf(stderr,"slowreader from libtorque %s\n",torque_version());
+}
+
+static void
+usage(const char *argv0){
+	fprintf(stderr,"usage: %s [ options ]\n",argv0);
+	fprintf(stderr,"available options:\n");
+	fprintf(stderr,"\t-h: print this message\n");
+	fprintf(stderr,"\t-t secs: txidle timeout (default: %d)\n",DEFAULT_SECS);
+	fprintf(stderr,"\t--version: print version info\n");
+}
+
+static int
+parse_args(int argc,char **argv,unsigned *secs){
+	int lflag;
+	const struct option opts[] = {
+		{	 .name = "version",
+			.has_arg = 0,
+			.flag = &lflag,
+			.val = 'v',
+		},
+		{	 .name = NULL, .has_arg = 0, .flag = 0, .val = 0, },
+	};
+	const char *argv0 = *argv;
+	int c;
+
+	while((c = getopt_long(argc,argv,"t:h",opts,NULL)) >= 0){
+		switch(c){
+		case 't':
+			if((*secs = strtoul(optarg,NULL,0)) == 0){
+				goto err;
+			}
+			break;
+		case 'h':
+			usage(argv0);
+			exit(EXIT_SUCCESS);
+		case 0: // long option
+			switch(lflag){
+				case 'v':
+					print_version();
+					exit(EXIT_SUCCESS);
+				default:
+					goto err;
+			}
+		default:
+			goto err;
+		}
+	}
+	return 0;
+
+err:
+	usage(argv0);
+	return -1;
+}
+
+static void
+check_expired(int fd __attribute__ ((unused)),torque_timeout why,
+		void *v __attribute__ ((unused))){
+	check.why = why;
+	__sync_synchronize();
+	check.expired = 1;
+}
+
+// Queue everything at once, and ask to be closed once it's written (which,
+// the peer never reading, it won't be).
+static int
+check_tx(int fd __attribute__ ((unused)),struct torque_rxbuf *rxb,
+		void *v __attribute__ ((unused))){
+	struct torque_txbuf *txb = torque_gettxbuf(rxb);
+
+	if(torque_txref(txb,buf,QUEUED,NULL,NULL)){
+		return -1;
+	}
+	torque_txclose(txb);
+	return -1;
+}
+
+// A connected pair of TCP sockets over loopback.
+static int
+loopback_pair(int *rd,int *wr){
+	union {
+		struct sockaddr_in sin;
+		struct sockaddr sa;
+	} su;
+	socklen_t slen = sizeof(su.sin);
+	int sd,flags;
+
+	*rd = *wr = -1;
+	memset(&su,0,sizeof(su));
+	su.sin.sin_family = AF_INET;
+	su.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if((sd = socket(AF_INET,SOCK_STREAM,0)) < 0){
+		return -1;
+	}
+	if(bind(sd,&su.sa,slen) || listen(sd,1) || getsockname(sd,&su.sa,&slen)){
+		goto err;
+	}
+	if((*rd = socket(AF_INET,SOCK_STREAM,0)) < 0 || connect(*rd,&su.sa,slen)){
+		goto err;
+	}
+	if((*wr = accept(sd,NULL,NULL)) < 0){
+		goto err;
+	}
+	if((flags = fcntl(*wr,F_GETFL)) < 0 || fcntl(*wr,F_SETFL,flags | O_NONBLOCK)){
+		goto err;
+	}
+	close(sd);
+	return 0;
+
+err:
+	if(*wr >= 0){
+		close(*wr);
+	}
+	if(*rd >= 0){
+		close(*rd);
+	}
+	close(sd);
+	return -1;
+}
+
+int main(int argc,char **argv){
+	struct torque_ctx *ctx = NULL;
+	struct timespec t0,t1;
+	torque_timeouts tos;
+	unsigned secs = 0;
+	int rd,wr,ret = EXIT_FAILURE;
+	torque_err err;
+
+	if(parse_args(argc,argv,&secs)){
+		return EXIT_FAILURE;
+	}
+	secs = secs ? secs : DEFAULT_SECS;
+	if( (err = torque_sigmask(NULL)) ){
+		fprintf(stderr,"Couldn't mask signals (%s)\n",torque_errstr(err));
+		return EXIT_FAILURE;
+	}
+	if((buf = malloc(QUEUED)) == NULL){
+		return EXIT_FAILURE;
+	}
+	memset(buf,'s',QUEUED);
+	if(loopback_pair(&rd,&wr)){
+		fprintf(stderr,"Couldn't connect over loopback (%s)\n",strerror(errno));
+		free(buf);
+		return EXIT_FAILURE;
+	}
+	if((ctx = torque_init(&err)) == NULL){
+		fprintf(stderr,"Couldn't initialize libtorque (%s)\n",torque_errstr(err));
+		goto done;
+	}
+	memset(&tos,0,sizeof(tos));
+	tos.txidle.tv_sec = secs;
+	tos.lifetime.tv_sec = secs * 2;
+	tos.expirecb = check_expired;
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	t1 = t0;
+	if( (err = torque_addfd_timeouts(ctx,wr,NULL,check_tx,NULL,&tos)) ){
+		fprintf(stderr,"Couldn't add sd %d (%s)\n",wr,torque_errstr(err));
+		close(wr);
+		goto done;
+	}
+	while(!check.expired && t1.tv_sec - t0.tv_sec < secs * 2 + GRACE_SECS){
+		usleep(10000);
+		clock_gettime(CLOCK_MONOTONIC,&t1);
+	}
+	__sync_synchronize();
+	if(!check.expired){
+		fprintf(stderr,"Connection outlived its timeouts (%us)\n",secs);
+	}else if(check.why != TORQUE_TIMEOUT_TXIDLE){
+		fprintf(stderr,"Connection timed out, but not by txidle (%d)\n",check.why);
+	}else{
+		printf("Timed out after %.2fs (txidle %us)\n",(t1.tv_sec - t0.tv_sec) +
+				(t1.tv_nsec - t0.tv_nsec) / 1e9,secs);
+		ret = EXIT_SUCCESS;
+	}
+
+done:
+	if(ctx && (err = torque_stop(ctx))){
+		fprintf(stderr,"Couldn't shutdown libtorque (%s)\n",torque_errstr(err));
+		ret = EXIT_FAILURE;
+	}
+	close(rd);
+	free(buf);
+	return ret;
+}
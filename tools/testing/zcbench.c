@@ -0,0 +1,304 @@
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <libtorque/torque.h>
+
+// Compare the throughput (and CPU cost) of the buffered transmit path over
+// loopback TCP, copying and with MSG_ZEROCOPY (see torque_txzerocopy()). A
+// single connection is registered with libtorque, whose write callback keeps
+// DEPTH references to one buffer queued; the main thread reads and discards.
+// Note that the kernel copies zerocopy output delivered over loopback anyway
+// (when it's received), so this measures the cost of the mechanism more than
+// its benefit, which is seen on real NICs.
+#define DEFAULT_LEN	(256u << 10)
+#define DEFAULT_SECS	5
+#define DEPTH		4
+
+typedef struct benchstate {
+	const char *buf;
+	size_t len;
+	size_t thresh;			// 0 to copy
+	int enabled;			// torque_txzerocopy() has been called
+	int failed;
+	uint64_t released;		// bytes released by libtorque
+} benchstate;
+
+// Buffered callbacks get libtorque's connection state rather than ours (see
+// torque_addfd()), so the run in progress is found here.
+static benchstate *running;
+
+static void
+print_version(void){
+	fprintf(stderr,"zcbench from libtorque %s\n",torque_version());
+}
+
+static void
+usage(const char *argv0){
+	fprintf(stderr,"usage: %s [ options ]\n",argv0);
+	fprintf(stderr,"available options:\n");
+	fprintf(stderr,"\t-h: print this message\n");
+	fprintf(stderr,"\t-l bytes: size of each write (default: %u)\n",DEFAULT_LEN);
+	fprintf(stderr,"\t-t secs: duration of each run (default: %d)\n",DEFAULT_SECS);
+	fprintf(stderr,"\t-z bytes: zerocopy threshold (default: the write size)\n");
+	fprintf(stderr,"\t--version: print version info\n");
+}
+
+static int
+parse_args(int argc,char **argv,size_t *len,unsigned *secs,size_t *thresh){
+	int lflag;
+	const struct option opts[] = {
+		{	 .name = "version",
+			.has_arg = 0,
+			.flag = &lflag,
+			.val = 'v',
+		},
+		{	 .name = NULL, .has_arg = 0, .flag = 0, .val = 0, },
+	};
+	const char *argv0 = *argv;
+	int c;
+
+	while((c = getopt_long(argc,argv,"l:t:z:h",opts,NULL)) >= 0){
+		switch(c){
+		case 'l':
+			if((*len = strtoul(optarg,NULL,0)) == 0){
+				goto err;
+			}
+			break;
+		case 't':
+			if((*secs = strtoul(optarg,NULL,0)) == 0){
+				goto err;
+			}
+			break;
+		case 'z':
+			if((*thresh = strtoul(optarg,NULL,0)) == 0){
+				goto err;
+			}
+			break;
+		case 'h':
+			usage(argv0);
+			exit(EXIT_SUCCESS);
+		case 0: // long option
+			switch(lflag){
+				case 'v':
+					print_version();
+					exit(EXIT_SUCCESS);
+				default:
+					goto err;
+			}
+		default:
+			goto err;
+		}
+	}
+	return 0;
+
+err:
+	usage(argv0);
+	return -1;
+}
+
+static void
+bench_released(const void *buf __attribute__ ((unused)),size_t len,void *v){
+	benchstate *bs = v;
+
+	__sync_fetch_and_add(&bs->released,len);
+}
+
+// Called once the connection's writable with nothing queued. A write failing
+// (the reader having closed its end) tears down the connection.
+static int
+bench_tx(int fd,struct torque_rxbuf *rxb,void *v __attribute__ ((unused))){
+	struct torque_txbuf *txb = torque_gettxbuf(rxb);
+	benchstate *bs = running;
+	int i;
+
+	if(!bs->enabled){
+		bs->enabled = 1;
+		if(bs->thresh && torque_txzerocopy(txb,bs->thresh)){
+			bs->failed = 1;
+			goto err;
+		}
+	}
+	for(i = 0 ; i < DEPTH ; ++i){
+		if(torque_txref(txb,bs->buf,bs->len,bench_released,bs)){
+			goto err;
+		}
+	}
+	return 0;
+
+err:
+	close(fd);
+	return -1;
+}
+
+// A connected pair of TCP sockets over loopback.
+static int
+loopback_pair(int *rd,int *wr){
+	union {
+		struct sockaddr_in sin;
+		struct sockaddr sa;
+	} su;
+	socklen_t slen = sizeof(su.sin);
+	int sd,flags;
+
+	*rd = *wr = -1;
+	memset(&su,0,sizeof(su));
+	su.sin.sin_family = AF_INET;
+	su.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if((sd = socket(AF_INET,SOCK_STREAM,0)) < 0){
+		return -1;
+	}
+	if(bind(sd,&su.sa,slen) || listen(sd,1) || getsockname(sd,&su.sa,&slen)){
+		goto err;
+	}
+	if((*rd = socket(AF_INET,SOCK_STREAM,0)) < 0 || connect(*rd,&su.sa,slen)){
+		goto err;
+	}
+	if((*wr = accept(sd,NULL,NULL)) < 0){
+		goto err;
+	}
+	if((flags = fcntl(*wr,F_GETFL)) < 0 || fcntl(*wr,F_SETFL,flags | O_NONBLOCK)){
+		goto err;
+	}
+	close(sd);
+	return 0;
+
+err:
+	if(*wr >= 0){
+		close(*wr);
+	}
+	if(*rd >= 0){
+		close(*rd);
+	}
+	close(sd);
+	return -1;
+}
+
+static double
+elapsed(const struct timespec *t0,const struct timespec *t1){
+	return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static double
+cpusecs(void){
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF,&ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+// Returns the bytes read in secs, or 0 on error.
+static uint64_t
+bench_run(benchstate *bs,unsigned secs,double *wall,double *cpu){
+	struct torque_ctx *ctx = NULL;
+	struct timespec t0,t1;
+	uint64_t total = 0;
+	torque_err err;
+	int rd,wr;
+	double c0;
+	char *buf;
+
+	if((buf = malloc(1u << 20)) == NULL){
+		return 0;
+	}
+	if(loopback_pair(&rd,&wr)){
+		fprintf(stderr,"Couldn't connect over loopback (%s)\n",strerror(errno));
+		free(buf);
+		return 0;
+	}
+	if((ctx = torque_init(&err)) == NULL){
+		fprintf(stderr,"Couldn't initialize libtorque (%s)\n",torque_errstr(err));
+		goto done;
+	}
+	running = bs;
+	c0 = cpusecs();
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	t1 = t0;
+	if( (err = torque_addfd(ctx,wr,NULL,bench_tx,bs)) ){
+		fprintf(stderr,"Couldn't add sd %d (%s)\n",wr,torque_errstr(err));
+		close(wr);
+		goto done;
+	}
+	do{
+		ssize_t r;
+
+		if((r = read(rd,buf,1u << 20)) <= 0){
+			break;
+		}
+		total += r;
+		clock_gettime(CLOCK_MONOTONIC,&t1);
+	}while(elapsed(&t0,&t1) < secs);
+	*wall = elapsed(&t0,&t1);
+	*cpu = cpusecs() - c0;
+
+done:
+	close(rd); // the writer's next write fails, and it's torn down
+	if(ctx && (err = torque_stop(ctx))){
+		fprintf(stderr,"Couldn't shutdown libtorque (%s)\n",torque_errstr(err));
+		total = 0;
+	}
+	free(buf);
+	return total;
+}
+
+static int
+bench_report(const char *mode,benchstate *bs,unsigned secs){
+	double wall = 0,cpu = 0;
+	uint64_t total;
+
+	total = bench_run(bs,secs,&wall,&cpu);
+	if(bs->failed){ // the connection was torn down, so nothing was read
+		fprintf(stderr,"Couldn't enable zerocopy (needs Linux 4.14+)\n");
+		return -1;
+	}
+	if(total == 0 || wall <= 0){
+		return -1;
+	}
+	printf("%-10s %10.1f MiB/s %8.3f CPU s/GiB (%zub writes, %llu bytes released)\n",
+			mode,total / wall / (1u << 20),cpu / (total / (double)(1u << 30)),
+			bs->len,(unsigned long long)bs->released);
+	return 0;
+}
+
+int main(int argc,char **argv){
+	benchstate copy,zc;
+	unsigned secs = 0;
+	size_t len = 0,thresh = 0;
+	torque_err err;
+	char *buf;
+
+	if(parse_args(argc,argv,&len,&secs,&thresh)){
+		return EXIT_FAILURE;
+	}
+	len = len ? len : DEFAULT_LEN;
+	secs = secs ? secs : DEFAULT_SECS;
+	thresh = thresh ? thresh : len;
+	if( (err = torque_sigmask(NULL)) ){
+		fprintf(stderr,"Couldn't mask signals (%s)\n",torque_errstr(err));
+		return EXIT_FAILURE;
+	}
+	if((buf = malloc(len)) == NULL){
+		return EXIT_FAILURE;
+	}
+	memset(buf,'z',len);
+	memset(&copy,0,sizeof(copy));
+	copy.buf = buf;
+	copy.len = len;
+	zc = copy;
+	zc.thresh = thresh;
+	if(bench_report("copy",&copy,secs) || bench_report("zerocopy",&zc,secs)){
+		free(buf);
+		return EXIT_FAILURE;
+	}
+	free(buf);
+	return EXIT_SUCCESS;
+}